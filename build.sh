@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# NOTE: Builds the headless simulation for Linux (see code/dungeons_headless.cpp). The game
+# itself is still Windows only, use build.bat for that.
+
+SHARED_FLAGS="-std=c++14 -g -msse4.1 -maes -fno-rtti -fno-exceptions -ffast-math -Wno-write-strings -I../code/external -DCOMPILER_GCC=1"
+SANITIZE_FLAGS="-O1 -DDUNGEONS_INTERNAL=1 -DDUNGEONS_SLOW=1 -fsanitize=address,undefined"
+DEBUG_FLAGS="-O0 -DDUNGEONS_INTERNAL=1 -DDUNGEONS_SLOW=1"
+RELEASE_FLAGS="-O2 -DDUNGEONS_INTERNAL=1"
+LINKER_LIBRARIES="-lpthread"
+
+FLAGS="$SHARED_FLAGS"
+echo
+if [ "$1" = "release" ]; then
+    echo "------------------------------------------"
+    echo "*** BUILDING RELEASE BUILD FROM SOURCE ***"
+    echo "------------------------------------------"
+    FLAGS="$FLAGS $RELEASE_FLAGS"
+elif [ "$1" = "sanitize" ]; then
+    echo "--------------------------------------------"
+    echo "*** BUILDING SANITIZED BUILD FROM SOURCE ***"
+    echo "--------------------------------------------"
+    FLAGS="$FLAGS $SANITIZE_FLAGS"
+else
+    echo "----------------------------------------"
+    echo "*** BUILDING DEBUG BUILD FROM SOURCE ***"
+    echo "----------------------------------------"
+    FLAGS="$FLAGS $DEBUG_FLAGS"
+fi
+
+mkdir -p build
+cd build
+echo "COMPILER: ${CXX:-g++}"
+${CXX:-g++} ../code/linux_headless_dungeons.cpp $FLAGS -o linux_headless_dungeons $LINKER_LIBRARIES
@@ -6,8 +6,13 @@
 #include "dungeons_render.cpp"
 #include "dungeons_controller.cpp"
 #include "dungeons_entity.cpp"
+#include "dungeons_pathfinding.cpp"
 #include "dungeons_worldgen.cpp"
 
+#if DUNGEONS_INTERNAL
+#include "dungeons_benchmark.cpp"
+#endif
+
 DebugTable *debug_table;
 
 // Ryan's text controls example: https://hatebin.com/ovcwtpsfmj
@@ -111,7 +116,7 @@ CalculateLightMap(LightMap *light_map)
     if (light_source)
     {
         V3 light_color = SRGBToLinear(light_source->sprites[light_source->sprite_index].foreground);
-        V2i origin = light_source->p;
+        V2i origin = PositionOf(light_source);
 
         ScopedMemory quadrant_temp(arena);
         for (int quadrant = 0; quadrant < 4; quadrant += 1)
@@ -165,22 +170,12 @@ CalculateLightMap(LightMap *light_map)
                         float light_strength = 1.0f / Max(1.0f, length);
                         light_map->map[abs_p.y][abs_p.x] += light_strength*light_color;
                     }
-                    else
+                    else if (TileBlocksSight(abs_p))
                     {
-                        Entity *entities_on_tile = entity_manager->entity_grid[abs_p.x][abs_p.y];
-                        for (Entity *e = entities_on_tile;
-                             e;
-                             e = e->next_on_tile)
-                        {
-                            if (HasProperty(e, EntityProperty_BlockSight))
-                            {
-                                tile = Tile_Wall;
-                                float length = (float)LengthSq(rel_p);
-                                float light_strength = 1.0f / Max(1.0f, length);
-                                light_map->map[abs_p.y][abs_p.x] += light_strength*light_color;
-                                break;
-                            }
-                        }
+                        tile = Tile_Wall;
+                        float length = (float)LengthSq(rel_p);
+                        float light_strength = 1.0f / Max(1.0f, length);
+                        light_map->map[abs_p.y][abs_p.x] += light_strength*light_color;
                     }
 
                     if ((prev_tile == Tile_Wall) && (tile == Tile_Floor))
@@ -267,6 +262,13 @@ AppUpdateAndRender(Platform *platform_)
         game_state->debug_fullbright = !game_state->debug_fullbright;
     }
 
+#if DUNGEONS_INTERNAL
+    if (Pressed(input->f_keys[3]))
+    {
+        RunBenchmarks();
+    }
+#endif
+
     if (!game_state->world_generated)
     {
         game_state->world_generated = EndGenerateWorld(&game_state->gen_tiles);
@@ -324,9 +326,9 @@ AppUpdateAndRender(Platform *platform_)
         if (player)
         {
             StringList list = {};
-            for (Entity *e: Linearize(&player->inventory))
+            for (EntityListIter iter = IterateList(&player->inventory); IsValid(iter); Next(&iter))
             {
-                EntityToString(e, &list);
+                EntityToString(iter.entity, &list);
             }
             if (!IsEmpty(&list))
             {
@@ -377,11 +379,11 @@ AppUpdateAndRender(Platform *platform_)
         {
             StringList list = {};
             int count = 0;
-            for (Entity *e = GetEntitesOnTile(player->p);
+            for (Entity *e = GetEntitesOnTile(PositionOf(player));
                  e;
                  e = e->next_on_tile)
             {
-                if (e->handle == player->handle)
+                if (HandleFromEntity(e) == HandleFromEntity(player))
                 {
                     continue;
                 }
@@ -391,11 +393,11 @@ AppUpdateAndRender(Platform *platform_)
             if (count > 0)
             {
                 size_t i = 0;
-                for (Entity *e = GetEntitesOnTile(player->p);
+                for (Entity *e = GetEntitesOnTile(PositionOf(player));
                      e;
                      e = e->next_on_tile)
                 {
-                    if (e->handle != player->handle)
+                    if (HandleFromEntity(e) != HandleFromEntity(player))
                     {
                         if (entity_manager->looking_at_ground &&
                             (i == entity_manager->container_selection_index))
@@ -409,7 +411,7 @@ AppUpdateAndRender(Platform *platform_)
             }
             if (!IsEmpty(&list))
             {
-                V2i p = WorldToUi(player->p + MakeV2i(0, 1));
+                V2i p = WorldToUi(PositionOf(player) + MakeV2i(0, 1));
 
                 StringRenderSpec spec = {};
                 spec.y_align_percentage = 1.0f;
@@ -426,20 +428,20 @@ AppUpdateAndRender(Platform *platform_)
             Entity *container = entity_manager->looking_at_container;
 
             StringList list = {};
-            EntityArray inventory = Linearize(&container->inventory);
-            for (size_t i = 0; i < inventory.count; i += 1)
+            int i = 0;
+            for (EntityListIter iter = IterateList(&container->inventory); IsValid(iter); Next(&iter))
             {
-                Entity *e = inventory[i];
                 if (i == entity_manager->container_selection_index)
                 {
                     PushTempStringF(&list, ">");
                 }
-                EntityToString(e, &list);
+                EntityToString(iter.entity, &list);
+                i += 1;
             }
 
             if (!IsEmpty(&list))
             {
-                V2i p = WorldToUi(container->p + MakeV2i(0, 1));
+                V2i p = WorldToUi(PositionOf(container) + MakeV2i(0, 1));
 
                 StringRenderSpec spec = {};
                 spec.y_align_percentage = 1.0f;
@@ -470,3 +472,5 @@ AppUpdateAndRender(Platform *platform_)
 #if DUNGEONS_INTERNAL
 #include "dungeons_debug.cpp"
 #endif
+
+#include "dungeons_headless.cpp"
@@ -4,6 +4,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+// NOTE: These only bound the light map now, the entity manager is sized to the generated
+// world at runtime (see InitializeEntityManager).
 #define WORLD_SIZE_X 1024
 #define WORLD_SIZE_Y 1024
 
@@ -19,6 +21,7 @@
 #include "dungeons_render.hpp"
 #include "dungeons_controller.hpp"
 #include "dungeons_entity.hpp"
+#include "dungeons_pathfinding.hpp"
 #include "dungeons_worldgen.hpp"
 
 struct GameState
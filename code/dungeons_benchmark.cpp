@@ -0,0 +1,561 @@
+//
+// NOTE: Debug benchmarks, bound to F3. These run against a scratch EntityManager so they
+// leave the world you're playing in alone, and report through the log.
+//
+
+struct BenchmarkTimer
+{
+    PlatformHighResTime start;
+    int repeat_count;
+};
+
+static inline BenchmarkTimer
+BeginBenchmark(int repeat_count)
+{
+    BenchmarkTimer result = {};
+    result.start = platform->GetTime();
+    result.repeat_count = repeat_count;
+    return result;
+}
+
+static inline void
+EndBenchmark(BenchmarkTimer *timer, const char *name, size_t items_per_repeat)
+{
+    double seconds = platform->SecondsElapsed(timer->start, platform->GetTime());
+    double ms_per_repeat = 1000.0*seconds / (double)timer->repeat_count;
+    double items_per_second = (double)items_per_repeat*(double)timer->repeat_count / seconds;
+    platform->LogPrint(PlatformLogLevel_Info, "%s: %.3fms, %.1fM/s",
+                       name, ms_per_repeat, items_per_second / 1000000.0);
+}
+
+static inline EntityManager *
+BeginScratchEntityManager(void)
+{
+    EntityManager *result = BootstrapPushStruct(EntityManager, arena);
+    return result;
+}
+
+static inline void
+EndScratchEntityManager(EntityManager *scratch)
+{
+    Assert(scratch == entity_manager);
+    ReleaseEntityStorage();
+
+    Arena arena = scratch->arena;
+    Release(&arena);
+}
+
+// NOTE: How entities were laid out before the hot data got split off into its own arrays,
+// everything in one record. The scans get run over a copy of the world in this layout too, so
+// there's something to compare against.
+struct ReferenceEntity
+{
+    EntityHandle handle;
+    Entity cold;
+    V2i p;
+    int32_t speed;
+    int32_t energy;
+    EntityPropertySet properties;
+};
+
+static inline ReferenceEntity *
+PushReferenceEntities(Arena *arena)
+{
+    uint32_t count = entity_manager->entity_count;
+    ReferenceEntity *result = PushArray(arena, count, ReferenceEntity);
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        ReferenceEntity *reference = &result[index];
+        reference->handle = entity_manager->entity_handles[index];
+        CopyStruct(&entity_manager->entities[index], &reference->cold);
+        reference->p = entity_manager->entity_positions[index];
+        reference->speed = entity_manager->entity_speed[index];
+        reference->properties = entity_manager->entity_properties[index];
+    }
+    return result;
+}
+
+static void
+BenchmarkEntityScans(void)
+{
+    EntityManager *prev_entity_manager = entity_manager;
+    entity_manager = BeginScratchEntityManager();
+    // NOTE: Fill a 256x256 world with an entity on every tile but the first, 65535 in all. Most
+    // of them are gold lying around, with an orc every 64 tiles for the filtered scans to find.
+    int world_w = 256;
+    int world_h = 256;
+    InitializeEntityManager(world_w, world_h);
+    {
+        Arena *temp_arena = platform->GetTempArena();
+        ScopedMemory temp(temp_arena);
+
+        size_t tile_count = (size_t)world_w*world_h;
+        size_t orc_count = 0;
+        size_t gold_count = 0;
+        V2i *orc_positions = PushArrayNoClear(temp_arena, tile_count, V2i);
+        V2i *gold_positions = PushArrayNoClear(temp_arena, tile_count, V2i);
+        for (size_t i = 1; i < tile_count; i += 1)
+        {
+            V2i p = MakeV2i((int)(i % world_w), (int)(i / world_w));
+            if (i % 64 == 0) orc_positions[orc_count++] = p;
+            else             gold_positions[gold_count++] = p;
+        }
+
+        SpawnBatch(&entity_manager->prefabs[Prefab_Orc], orc_positions, orc_count);
+        SpawnBatch(&entity_manager->prefabs[Prefab_Gold], gold_positions, gold_count);
+    }
+
+    size_t entity_count = entity_manager->entity_count - 1;
+    int repeat_count = 64;
+
+    volatile int32_t sink = 0;
+
+    ReferenceEntity *references = PushReferenceEntities(&entity_manager->arena);
+    uint32_t reference_count = entity_manager->entity_count;
+    EntityPropertySet alive = MakeSet(EntityProperty_Alive);
+    EntityPropertySet alive_with_grid = CombineSet(alive, MakeSet(EntityProperty_HasVisibilityGrid));
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            int32_t sum = 0;
+            for (uint32_t index = 1; index < reference_count; ++index)
+            {
+                ReferenceEntity *reference = &references[index];
+                if (HasProperties(&reference->properties, alive))
+                {
+                    sum += reference->p.x + reference->p.y;
+                }
+            }
+            sink = sum;
+        }
+        EndBenchmark(&timer, "Full entity scan (reference)", entity_count);
+    }
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            int32_t sum = 0;
+            for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
+            {
+                V2i p = PositionOf(iter.entity);
+                sum += p.x + p.y;
+            }
+            sink = sum;
+        }
+        EndBenchmark(&timer, "Full entity scan", entity_count);
+    }
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            int32_t sum = 0;
+            for (uint32_t index = 1; index < reference_count; ++index)
+            {
+                ReferenceEntity *reference = &references[index];
+                if (HasProperties(&reference->properties, alive_with_grid))
+                {
+                    sum += reference->speed;
+                }
+            }
+            sink = sum;
+        }
+        EndBenchmark(&timer, "Filtered entity scan (reference)", entity_count);
+    }
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            int32_t sum = 0;
+            for (EntityIter iter = IterateAllEntities(EntityProperty_HasVisibilityGrid); IsValid(iter); Next(&iter))
+            {
+                sum += SpeedOf(iter.entity);
+            }
+            sink = sum;
+        }
+        EndBenchmark(&timer, "Filtered entity scan (HasVisibilityGrid)", entity_count);
+    }
+
+    {
+        V2i center = MakeV2i(world_w / 2, world_h / 2);
+
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            // NOTE: The old FindClosestEntity, a linear scan over everything
+            uint32_t best_dist = UINT32_MAX;
+            uint32_t best_index = 0;
+            for (uint32_t index = 1; index < reference_count; ++index)
+            {
+                ReferenceEntity *reference = &references[index];
+                if (HasProperties(&reference->properties, alive_with_grid))
+                {
+                    uint32_t dist = LengthSq(reference->p - center);
+                    if (dist < best_dist)
+                    {
+                        best_dist = dist;
+                        best_index = index;
+                    }
+                }
+            }
+            sink = (int32_t)best_index;
+        }
+        EndBenchmark(&timer, "FindClosestEntity (reference)", entity_count);
+    }
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            Entity *closest = FindClosestEntity(MakeV2i(world_w / 2, world_h / 2), EntityProperty_HasVisibilityGrid);
+            sink = closest ? (int32_t)EntityIndex(closest) : 0;
+        }
+        EndBenchmark(&timer, "FindClosestEntity", entity_count);
+    }
+
+    UNUSED_VARIABLE(sink);
+
+    EndScratchEntityManager(entity_manager);
+    entity_manager = prev_entity_manager;
+}
+
+static inline int32_t
+SumEntityPositions(void)
+{
+    int32_t sum = 0;
+    for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
+    {
+        V2i p = PositionOf(iter.entity);
+        sum += p.x + p.y;
+    }
+    return sum;
+}
+
+static void
+BenchmarkEntityCompaction(void)
+{
+    EntityManager *prev_entity_manager = entity_manager;
+    entity_manager = BeginScratchEntityManager();
+
+    int world_w = 256;
+    int world_h = 256;
+    InitializeEntityManager(world_w, world_h);
+
+    // NOTE: Simulate churn, fill the world with loot and then kill most of it off at random.
+    RandomSeries entropy = MakeRandomSeries(0xC0FFEE);
+    for (int y = 0; y < world_h; y += 1)
+    for (int x = 0; x < world_w; x += 1)
+    {
+        if (x % 4 == 0)
+        {
+            AddGold(MakeV2i(x, y), 1);
+        }
+    }
+
+    for (uint32_t index = entity_manager->entity_count - 1; index > 0; index -= 1)
+    {
+        if (RandomChoice(&entropy, 8) != 0)
+        {
+            KillEntity(&entity_manager->entities[index]);
+        }
+    }
+
+    int repeat_count = 256;
+    volatile int32_t sink = 0;
+
+    EntityFragmentation before = GetEntityFragmentation();
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            sink = SumEntityPositions();
+        }
+        EndBenchmark(&timer, "Entity scan, fragmented", before.live_count);
+    }
+
+    {
+        BenchmarkTimer timer = BeginBenchmark(1);
+        CompactEntities();
+        EndBenchmark(&timer, "CompactEntities", before.live_count);
+    }
+
+    EntityFragmentation after = GetEntityFragmentation();
+    {
+        BenchmarkTimer timer = BeginBenchmark(repeat_count);
+        for (int repeat = 0; repeat < repeat_count; repeat += 1)
+        {
+            sink = SumEntityPositions();
+        }
+        EndBenchmark(&timer, "Entity scan, compacted", after.live_count);
+    }
+
+    platform->LogPrint(PlatformLogLevel_Info, "Live/high-water: %u/%u (%.2f) -> %u/%u (%.2f)",
+                       before.live_count, before.high_water, before.live_ratio,
+                       after.live_count, after.high_water, after.live_ratio);
+
+    UNUSED_VARIABLE(sink);
+
+    EndScratchEntityManager(entity_manager);
+    entity_manager = prev_entity_manager;
+}
+
+static void
+BenchmarkEntitySpawning(void)
+{
+    int world_w = 256;
+    int world_h = 256;
+    size_t count = (size_t)world_w*world_h / 2;
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    V2i *positions = PushArray(temp_arena, count, V2i);
+    for (size_t i = 0; i < count; i += 1)
+    {
+        positions[i] = MakeV2i((int)(2*i) % world_w, (int)(2*i) / world_w);
+    }
+
+    EntityManager *prev_entity_manager = entity_manager;
+
+    {
+        entity_manager = BeginScratchEntityManager();
+        InitializeEntityManager(world_w, world_h);
+
+        BenchmarkTimer timer = BeginBenchmark(1);
+        for (size_t i = 0; i < count; i += 1)
+        {
+            AddEntity(StringLiteral("Gold"), positions[i], MakeSprite('g', MakeColor(255, 255, 0)));
+        }
+        EndBenchmark(&timer, "AddEntity", count);
+
+        EndScratchEntityManager(entity_manager);
+    }
+
+    {
+        entity_manager = BeginScratchEntityManager();
+        InitializeEntityManager(world_w, world_h);
+
+        BenchmarkTimer timer = BeginBenchmark(1);
+        SpawnBatch(&entity_manager->prefabs[Prefab_Gold], positions, count);
+        EndBenchmark(&timer, "SpawnBatch", count);
+
+        EndScratchEntityManager(entity_manager);
+    }
+
+    entity_manager = prev_entity_manager;
+}
+
+static void
+BenchmarkInventoryStacking(void)
+{
+    EntityManager *prev_entity_manager = entity_manager;
+    entity_manager = BeginScratchEntityManager();
+    InitializeEntityManager(64, 64);
+
+    // NOTE: A chest full of different kinds of trinket, then a second helping of each that all
+    // have to find their stack. Only the sprite colour tells them apart. They spawn under the
+    // chest, so they stay out of the world like loot does.
+    int kind_count = 4096;
+    size_t item_count = 2*(size_t)kind_count;
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    Entity *chest = AddChest(MakeV2i(0, 0));
+    Entity **items = PushArrayNoClear(temp_arena, item_count, Entity *);
+    for (size_t i = 0; i < item_count; i += 1)
+    {
+        int kind = (int)(i % kind_count);
+        Color color = MakeColor((uint8_t)(kind & 255), (uint8_t)(16*(kind >> 8)), 0);
+        items[i] = AddEntity(StringLiteral("Trinket"), PositionOf(chest), MakeSprite('*', color));
+    }
+
+    BenchmarkTimer timer = BeginBenchmark(1);
+    for (size_t i = 0; i < item_count; i += 1)
+    {
+        AddToInventory(chest, items[i]);
+    }
+    EndBenchmark(&timer, "AddToInventory, 4096 kinds", item_count);
+
+    platform->LogPrint(PlatformLogLevel_Info, "%u stacks for %d kinds", chest->inventory.count, kind_count);
+
+    EndScratchEntityManager(entity_manager);
+    entity_manager = prev_entity_manager;
+}
+
+static void
+BenchmarkPathfinding(void)
+{
+    EntityManager *prev_entity_manager = entity_manager;
+    entity_manager = BeginScratchEntityManager();
+
+    // NOTE: Generate a world the usual way, but run the job right here so it lands in the
+    // scratch EntityManager.
+    GenTiles *tiles = BootstrapPushStruct(GenTiles, arena, Megabytes(4));
+    tiles->w = 256;
+    tiles->h = 256;
+    tiles->entropy = MakeRandomSeries(0xDEADBEFC);
+    DoWorldGen(tiles);
+
+    // NOTE: Open all the doors, so tile searches can go through rooms the way room graph
+    // plans do.
+    for (EntityIter iter = IterateAllEntities(EntityProperty_Door); IsValid(iter); Next(&iter))
+    {
+        UnsetProperty(iter.entity, EntityProperty_BlockMovement);
+        UnsetProperty(iter.entity, EntityProperty_BlockSight);
+    }
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    // NOTE: With the doors open any two corridor tiles have a path between them. Only keep
+    // pairs that are far apart, to get long winding searches.
+    size_t corridor_count = 0;
+    V2i *corridors = PushArrayNoClear(temp_arena, (size_t)tiles->w*tiles->h, V2i);
+    for (int y = 0; y < tiles->h; y += 1)
+    for (int x = 0; x < tiles->w; x += 1)
+    {
+        V2i p = MakeV2i(x, y);
+        if ((GetTile(tiles, p) == GenTile_Corridor) && !TileBlocksPathing(p))
+        {
+            corridors[corridor_count++] = p;
+        }
+    }
+
+    size_t pair_count = 0;
+    V2i *starts = PushArrayNoClear(temp_arena, 256, V2i);
+    V2i *targets = PushArrayNoClear(temp_arena, 256, V2i);
+
+    RandomSeries entropy = MakeRandomSeries(0xC0FFEE);
+    for (int attempt = 0; corridor_count && (attempt < 65536) && (pair_count < 256); attempt += 1)
+    {
+        V2i start = corridors[RandomChoice(&entropy, (uint32_t)corridor_count)];
+        V2i target = corridors[RandomChoice(&entropy, (uint32_t)corridor_count)];
+        if (GetOctileDistance(start, target) >= PATH_STRAIGHT_COST*128)
+        {
+            starts[pair_count] = start;
+            targets[pair_count] = target;
+            pair_count += 1;
+        }
+    }
+
+    Pathfinder *pathfinder = GetPathfinder();
+
+    static const struct { PathMode mode; const char *name; } modes[] =
+    {
+        { PathMode_AStar,     "FindPath (A*), corridor to corridor" },
+        { PathMode_JumpPoint, "FindPath (JPS), corridor to corridor" },
+    };
+
+    for (size_t mode_index = 0; mode_index < ArrayCount(modes); mode_index += 1)
+    {
+        PathOptions options = {};
+        options.mode = modes[mode_index].mode;
+
+        size_t found_count = 0;
+        size_t total_length = 0;
+        size_t total_expanded = 0;
+        for (size_t i = 0; i < pair_count; i += 1)
+        {
+            ScopedMemory path_temp(temp_arena);
+            Path path = FindPath(pathfinder, temp_arena, starts[i], targets[i], options);
+            found_count += (path.length > 0);
+            total_length += path.length;
+            total_expanded += pathfinder->expanded_count;
+        }
+
+        int repeat_count = 16;
+        {
+            BenchmarkTimer timer = BeginBenchmark(repeat_count);
+            for (int repeat = 0; repeat < repeat_count; repeat += 1)
+            {
+                for (size_t i = 0; i < pair_count; i += 1)
+                {
+                    ScopedMemory path_temp(temp_arena);
+                    FindPath(pathfinder, temp_arena, starts[i], targets[i], options);
+                }
+            }
+            EndBenchmark(&timer, modes[mode_index].name, total_length);
+        }
+
+        platform->LogPrint(PlatformLogLevel_Info, "%zu/%zu paths found, %.1f steps and %.1f nodes expanded on average",
+                           found_count, pair_count,
+                           (double)total_length / (found_count ? (double)found_count : 1.0),
+                           (double)total_expanded / (pair_count ? (double)pair_count : 1.0));
+    }
+
+    {
+        // NOTE: Compare the cost of the plan to the shortest path, to see what the shortcut
+        // of estimating the ends of the plan costs.
+        int64_t optimal_cost = 0;
+        int64_t plan_cost = 0;
+        size_t plan_length = 0;
+        size_t found_count = 0;
+        for (size_t i = 0; i < pair_count; i += 1)
+        {
+            ScopedMemory path_temp(temp_arena);
+            Path path = FindPath(pathfinder, temp_arena, starts[i], targets[i]);
+            RoomGraphPath plan = FindRoomGraphPath(pathfinder, temp_arena, starts[i], targets[i], nullptr);
+            if (path.length && plan.found)
+            {
+                optimal_cost += GetPathCost(starts[i], path);
+                plan_cost += GetPathCost(starts[i], plan.leg);
+                plan_length += plan.leg.length;
+                for (uint32_t waypoint_index = 1; waypoint_index < plan.waypoint_count; waypoint_index += 1)
+                {
+                    V2i from = plan.waypoints[waypoint_index - 1];
+                    V2i to = plan.waypoints[waypoint_index];
+                    Path leg = FindPath(pathfinder, temp_arena, from, to);
+                    plan_cost += GetPathCost(from, leg);
+                    plan_length += leg.length;
+                }
+                found_count += 1;
+            }
+        }
+
+        int repeat_count = 16;
+        {
+            BenchmarkTimer timer = BeginBenchmark(repeat_count);
+            for (int repeat = 0; repeat < repeat_count; repeat += 1)
+            {
+                for (size_t i = 0; i < pair_count; i += 1)
+                {
+                    ScopedMemory path_temp(temp_arena);
+                    FindRoomGraphPath(pathfinder, temp_arena, starts[i], targets[i], nullptr);
+                }
+            }
+            EndBenchmark(&timer, "FindRoomGraphPath, corridor to corridor", plan_length);
+        }
+
+        RoomGraph *graph = entity_manager->room_graph;
+        platform->LogPrint(PlatformLogLevel_Info, "%zu/%zu plans found, %.2f%% longer than the shortest path, %u nodes and %u edges",
+                           found_count, pair_count,
+                           100.0*((double)plan_cost / (optimal_cost ? (double)optimal_cost : 1.0) - 1.0),
+                           graph->node_count, graph->edge_count);
+    }
+
+    Release(&tiles->arena);
+
+    EndScratchEntityManager(entity_manager);
+    entity_manager = prev_entity_manager;
+}
+
+static void
+RunBenchmarks(void)
+{
+    platform->LogPrint(PlatformLogLevel_Info, "Running benchmarks...");
+
+    // NOTE: The benchmarks swap out entity_manager, so nothing on the low priority queue can be
+    // left running against it. That's world generation if F3 gets hit early on, and path requests.
+    platform->WaitForJobs(platform->low_priority_queue);
+
+    BenchmarkEntityScans();
+    BenchmarkEntityCompaction();
+    BenchmarkEntitySpawning();
+    BenchmarkInventoryStacking();
+    BenchmarkPathfinding();
+}
@@ -98,6 +98,11 @@ AppDebugEndFrame(void)
                     INVALID_CODE_PATH;
                 }
             } break;
+
+            case DebugEvent_Counter:
+            {
+                entry->hit_count += 1;
+            } break;
         }
     }
 }
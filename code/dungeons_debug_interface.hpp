@@ -13,6 +13,7 @@ enum DebugEventKind
 {
     DebugEvent_BeginProfileZone,
     DebugEvent_EndProfileZone,
+    DebugEvent_Counter,
 };
 
 struct DebugEvent
@@ -68,10 +69,15 @@ struct ProfileScopeHelper
 };
 #define ProfileScope() ProfileScopeHelper MACRO_VAR(profile_scope)(LOCATION_STRING(), __FUNCTION__)
 
+// NOTE: Counts how often something happens, it shows up as a profile entry with hits but no
+// time. Unlike ProfileScope this is fine to use on the job threads.
+#define ProfileCounter(name) DebugRecordEvent(DebugEvent_Counter, LOCATION_STRING(), name)
+
 #else /* !DUNGEONS_INTERNAL */
 
 #define ProfileTimestamp(...)
 #define ProfileScope(...)
+#define ProfileCounter(...)
 
 #endif /* DUNGEONS_INTERNAL */
 
@@ -1,461 +1,1610 @@
-static inline EntityNode *
-NewEntityNode(EntityHandle handle)
+static inline EntityHandle *
+GetHandles(EntityList *list)
 {
-    if (!entity_manager->first_free_entity_node)
+    EntityHandle *result = list->capacity ? list->handles : list->inline_handles;
+    return result;
+}
+
+static inline uint32_t
+GetCapacity(EntityList *list)
+{
+    uint32_t result = list->capacity ? list->capacity : ENTITY_LIST_INLINE_COUNT;
+    return result;
+}
+
+static inline uint32_t
+GetListSizeClass(uint32_t capacity)
+{
+    // NOTE: Blocks hold ENTITY_LIST_INLINE_COUNT*2^(size_class + 1) handles.
+    uint32_t result = FindLeastSignificantSetBit(capacity / (2*ENTITY_LIST_INLINE_COUNT)).index;
+    Assert(result < ENTITY_LIST_SIZE_CLASS_COUNT);
+    return result;
+}
+
+static inline EntityHandle *
+AllocateListBlock(uint32_t capacity)
+{
+    EntityListFreeBlock **free_list = &entity_manager->free_list_blocks[GetListSizeClass(capacity)];
+
+    EntityHandle *result;
+    if (*free_list)
+    {
+        result = (EntityHandle *)SllStackPop(*free_list);
+    }
+    else
     {
-        entity_manager->first_free_entity_node = PushStructNoClear(&entity_manager->arena, EntityNode);
+        result = PushArrayNoClear(&entity_manager->arena, capacity, EntityHandle);
     }
-    EntityNode *result = SllStackPop(entity_manager->first_free_entity_node);
-    result->next = nullptr;
-    result->handle = handle;
     return result;
 }
 
 static inline void
-FreeEntityNode(EntityNode *node)
+FreeListBlock(EntityHandle *handles, uint32_t capacity)
 {
-    SllStackPush(entity_manager->first_free_entity_node, node);
+    EntityListFreeBlock *block = (EntityListFreeBlock *)handles;
+    SllStackPush(entity_manager->free_list_blocks[GetListSizeClass(capacity)], block);
 }
 
-static inline EntityArray
-Linearize(EntityList *list)
+static inline void
+FreeList(EntityList *list)
 {
-    int count = 0;
-    for (EntityNode *node = list->first; node; node = node->next)
+    if (list->capacity)
     {
-        count += 1;
+        FreeListBlock(list->handles, list->capacity);
     }
+    ZeroStruct(list);
+}
 
-    EntityArray result = PushArrayContainer<Entity *>(platform->GetTempArena(), count);
-
-    for (EntityNode *node = list->first; node; node = node->next)
+static inline void
+AddToList(EntityList *list, EntityHandle handle)
+{
+    if (list->count >= GetCapacity(list))
     {
-        Entity *e = EntityFromHandle(node->handle);
-        if (e)
+        uint32_t new_capacity = 2*GetCapacity(list);
+        EntityHandle *handles = AllocateListBlock(new_capacity);
+        CopyArray(list->count, GetHandles(list), handles);
+        if (list->capacity)
         {
-            Push(&result, e);
+            FreeListBlock(list->handles, list->capacity);
         }
+        list->handles = handles;
+        list->capacity = new_capacity;
     }
 
-    return result;
+    GetHandles(list)[list->count++] = handle;
 }
 
-static inline EntityArray
-Pull(EntityList *list)
+static inline bool
+ListContains(EntityList *list, EntityHandle handle)
 {
-    int count = 0;
-    for (EntityNode *node = list->first; node; node = node->next)
+    EntityHandle *handles = GetHandles(list);
+    for (uint32_t i = 0; i < list->count; ++i)
     {
-        count += 1;
+        if (handles[i] == handle)
+        {
+            return true;
+        }
     }
+    return false;
+}
 
-    EntityArray result = PushArrayContainer<Entity *>(platform->GetTempArena(), count);
-
-    while (list->first)
+static inline void
+AddToListUnique(EntityList *list, EntityHandle handle)
+{
+    if (!ListContains(list, handle))
     {
-        EntityNode *node = SllQueuePop(list->first, list->last);
+        AddToList(list, handle);
+    }
+}
 
-        Entity *e = EntityFromHandle(node->handle);
-        if (e && HasProperty(e, EntityProperty_Alive))
-        {
-            Push(&result, e);
-        }
+static inline EntityHandle
+RemoveFromListOrdered(EntityList *list, uint32_t remove_index)
+{
+    AssertSlow(remove_index < list->count);
+
+    EntityHandle *handles = GetHandles(list);
+    EntityHandle result = handles[remove_index];
 
-        FreeEntityNode(node);
+    list->count -= 1;
+    for (uint32_t i = remove_index; i < list->count; ++i)
+    {
+        handles[i] = handles[i + 1];
     }
-    list->first = list->last = nullptr;
 
     return result;
 }
 
 static inline void
-Place(EntityList *list, EntityArray array)
+CleanStaleReferences(EntityList *list)
 {
-    for (size_t i = 0; i < array.count; ++i)
+    // NOTE: Compacts the list in place, keeping the order of the entities that are left.
+    EntityHandle *handles = GetHandles(list);
+    uint32_t keep_count = 0;
+    for (uint32_t i = 0; i < list->count; ++i)
     {
-        if (array[i])
+        Entity *e = EntityFromHandle(handles[i]);
+        if (e && HasProperty(e, EntityProperty_Alive))
         {
-            EntityNode *node = NewEntityNode(array[i]->handle);
-            SllQueuePush(list->first, list->last, node);
+            handles[keep_count++] = handles[i];
         }
     }
+    list->count = keep_count;
 }
 
+struct EntityListIter
+{
+    EntityList *list;
+    uint32_t index;
+
+    Entity *entity;
+};
+
 static inline void
-CleanStaleReferences(EntityList *list)
+Next(EntityListIter *iter)
 {
-    // NOTE: Because pulling the list already filters out invalid handles,
-    // we can just rely on that. Cheeky. Performant? Maybe not. Whatever. @Speed
-    EntityArray array = Pull(list);
-    Place(list, array);
+    // NOTE: Handles to entities that have since died are skipped, not removed. Iterating
+    // doesn't touch the list, so it's fine to remove the current entity while iterating.
+    iter->entity = nullptr;
+    while (!iter->entity && (iter->index < iter->list->count))
+    {
+        iter->entity = EntityFromHandle(GetHandles(iter->list)[iter->index++]);
+    }
 }
 
-static inline void
-PushToList(Arena *arena, EntityList *list, EntityHandle handle)
+static inline EntityListIter
+IterateList(EntityList *list)
 {
-    EntityNode *node = PushStruct(arena, EntityNode);
-    node->handle = handle;
-    SllQueuePush(list->first, list->last, node);
+    EntityListIter result = {};
+    result.list = list;
+    Next(&result);
+    return result;
 }
 
-static inline void
-AddToList(EntityList *list, EntityHandle handle)
+static inline bool
+IsValid(const EntityListIter &iter)
 {
-    EntityNode *node = NewEntityNode(handle);
-    SllQueuePush(list->first, list->last, node);
+    return !!iter.entity;
 }
 
-static inline void
-AddToListUnique(EntityList *list, EntityHandle handle)
+static inline bool
+IsInWorld(V2i p)
+{
+    return ((p.x >= 0) &&
+            (p.y >= 0) &&
+            (p.x < entity_manager->world_w) &&
+            (p.y < entity_manager->world_h));
+}
+
+static inline EntityChunk *
+GetEntityChunk(V2i p, bool allocate)
 {
-    bool is_unique = true;
-    for (EntityNode *node = list->first;
-         node;
-         node = node->next)
+    EntityChunk *result = nullptr;
+    if (IsInWorld(p))
     {
-        if (node->handle == handle)
+        int chunk_index = ((p.y >> ENTITY_CHUNK_SIZE_LOG2)*entity_manager->chunk_count_x +
+                           (p.x >> ENTITY_CHUNK_SIZE_LOG2));
+        result = entity_manager->chunks[chunk_index];
+        if (!result && allocate)
         {
-            is_unique = false;
-            break;
+            result = entity_manager->chunks[chunk_index] = PushStruct(&entity_manager->arena, EntityChunk);
         }
     }
-    if (is_unique)
-    {
-        AddToList(list, handle);
-    }
+    return result;
 }
 
-static inline bool
-IsInWorld(V2i p)
+static inline Entity **
+GetChunkTile(EntityChunk *chunk, V2i p)
 {
-    return ((p.x >= 0) &&
-            (p.y >= 0) &&
-            (p.x < WORLD_SIZE_X) &&
-            (p.y < WORLD_SIZE_Y));
+    int local_x = p.x & (ENTITY_CHUNK_SIZE - 1);
+    int local_y = p.y & (ENTITY_CHUNK_SIZE - 1);
+    return &chunk->tiles[local_y*ENTITY_CHUNK_SIZE + local_x];
 }
 
-static inline Entity *
-EntityFromHandle(EntityHandle handle)
+static inline Entity **
+GetTileListHead(V2i p, bool allocate)
 {
-    Entity *slot = &entity_manager->entities[handle.index];
-    if (slot->handle == handle)
+    Entity **result = nullptr;
+    if (EntityChunk *chunk = GetEntityChunk(p, allocate))
     {
-        return slot;
+        result = GetChunkTile(chunk, p);
     }
-    return nullptr;
+    return result;
 }
 
-static inline EntityHandle
-HandleFromEntity(Entity *entity)
+static inline void
+LinkEntityIntoTile(Entity *e, V2i p)
 {
-    return entity->handle;
+    EntityChunk *chunk = GetEntityChunk(p, true);
+    Entity **head = GetChunkTile(chunk, p);
+    e->next_on_tile = *head;
+    *head = e;
+    chunk->occupancy += 1;
+    chunk->faction_occupancy[e->faction] += 1;
+    chunk->dormant_occupancy += e->dormant;
 }
 
 static inline Entity *
 GetEntitesOnTile(V2i p)
 {
     Entity *result = nullptr;
-    if (IsInWorld(p))
+    if (Entity **head = GetTileListHead(p, false))
     {
-        result = entity_manager->entity_grid[p.x][p.y];
+        result = *head;
     }
     return result;
 }
 
-static inline bool
-RemoveEntityFromGrid(Entity *e)
+static inline uint64_t *
+GetBitplaneRow(TileBitplane *plane, int y)
 {
-    Assert(IsInWorld(e->p));
-    for (Entity **it_at = &entity_manager->entity_grid[e->p.x][e->p.y];
-         *it_at;
-         it_at = &(*it_at)->next_on_tile)
-    {
-        Entity *it = *it_at;
-        if (it->handle == e->handle)
-        {
-            Assert(it == e);
-
-            *it_at = it->next_on_tile;
-            it->next_on_tile = nullptr;
-
-            return true;
-        }
-    }
+    return plane->words + (size_t)y*plane->words_per_row;
+}
 
-    return false;
+static inline void
+InitializeBitplane(TileBitplane *plane, int w, int h)
+{
+    plane->words_per_row = (w + 63) / 64;
+    plane->words = PushArray(&entity_manager->arena, (size_t)plane->words_per_row*h, uint64_t);
 }
 
 static inline bool
-MoveEntity(Entity *e, V2i p)
+GetTileBit(TileBitplane *plane, V2i p)
 {
-    Assert(IsInWorld(e->p));
-    Assert(IsInWorld(p));
-    for (Entity *it = entity_manager->entity_grid[p.x][p.y];
-         it;
-         it = it->next_on_tile)
+    bool result = false;
+    if (IsInWorld(p))
     {
-        if (HasProperty(it, EntityProperty_BlockMovement))
-        {
-            return false;
-        }
+        result = !!(GetBitplaneRow(plane, p.y)[p.x / 64] & (1ull << (p.x % 64)));
     }
-
-    RemoveEntityFromGrid(e);
-
-    e->next_on_tile = entity_manager->entity_grid[p.x][p.y];
-    entity_manager->entity_grid[p.x][p.y] = e;
-
-    e->p = p;
-    SetProperty(e, EntityProperty_InWorld);
-
-    return true;
+    return result;
 }
 
 static inline void
-SetContactTrigger(Entity *e, TriggerKind kind)
+SetTileBit(TileBitplane *plane, V2i p, bool value)
 {
-    e->contact_trigger = kind;
+    Assert(IsInWorld(p));
+    uint64_t bit = 1ull << (p.x % 64);
+    uint64_t *word = &GetBitplaneRow(plane, p.y)[p.x / 64];
+    if (value)
+    {
+        *word |= bit;
+    }
+    else
+    {
+        *word &= ~bit;
+    }
 }
 
-static inline Entity *
-AddEntity(String name, V2i p, Sprite sprite, EntityPropertySet initial_properties = {})
+static inline void
+UpdateTileBlocking(V2i p)
 {
-    Entity *result = nullptr;
-    if (entity_manager->first_free_entity)
+    if (!IsInWorld(p))
     {
-        result = entity_manager->first_free_entity;
-        entity_manager->first_free_entity = result->next_free;
+        return;
     }
 
-    if (!result && (entity_manager->entity_count < MAX_ENTITY_COUNT))
+    TerrainTile terrain = entity_manager->terrain[p.y*entity_manager->world_w + p.x];
+
+    bool blocks_movement = !!(terrain.flags & TerrainFlag_BlockMovement);
+    bool blocks_sight = !!(terrain.flags & TerrainFlag_BlockSight);
+    bool blocks_pathing = blocks_movement;
+    for (Entity *e = GetEntitesOnTile(p); e; e = e->next_on_tile)
     {
-        result = &entity_manager->entities[entity_manager->entity_count++];
+        bool e_blocks_movement = HasProperty(e, EntityProperty_BlockMovement);
+        blocks_movement |= e_blocks_movement;
+        blocks_sight |= HasProperty(e, EntityProperty_BlockSight);
+        blocks_pathing |= (e_blocks_movement && (e->ai == Ai_None) && (e != entity_manager->player));
     }
 
-    if (result)
+    SetTileBit(&entity_manager->block_movement, p, blocks_movement);
+    SetTileBit(&entity_manager->block_sight, p, blocks_sight);
+
+    if (GetTileBit(&entity_manager->block_pathing, p) != blocks_pathing)
     {
-        uint32_t gen = result->handle.generation + 1;
+        SetTileBit(&entity_manager->block_pathing, p, blocks_pathing);
+        entity_manager->pathing_version += 1;
 
-        ZeroStruct(result);
+        int chunk_index = ((p.y >> ENTITY_CHUNK_SIZE_LOG2)*entity_manager->chunk_count_x +
+                           (p.x >> ENTITY_CHUNK_SIZE_LOG2));
+        entity_manager->chunk_pathing_versions[chunk_index] = entity_manager->pathing_version;
 
-        SetProperties(result, initial_properties);
-        SetProperty(result, EntityProperty_Alive);
+        MarkRoomGraphTileChanged(p);
+    }
+}
 
-        result->handle = { (uint32_t)(result - entity_manager->entities), gen };
-        result->name = name;
-        result->p = p;
-        result->health = 2;
-        result->sprites[result->sprite_count++] = sprite;
-        result->speed = 100;
-        result->amount = 1;
-        result->view_radius = 24.0f;
+static inline TerrainMaterial
+GetTerrainMaterial(TerrainKind kind)
+{
+    TerrainMaterial result = {};
+    switch (kind)
+    {
+        case Terrain_None: {} break;
 
-        MoveEntity(result, p);
-    }
+        case Terrain_Wall:
+        {
+            result.sprite = MakeSprite(Glyph_Tone50, MakeColor(110, 165, 100));
+            result.flags = TerrainFlag_BlockMovement|TerrainFlag_BlockSight;
+        } break;
+
+        case Terrain_RoomWall:
+        {
+            result.sprite = MakeSprite(Glyph_Solid, MakeColor(196, 196, 196));
+            result.flags = TerrainFlag_BlockMovement|TerrainFlag_BlockSight;
+        } break;
 
+        INVALID_DEFAULT_CASE;
+    }
     return result;
 }
 
-static inline Entity *
-AddWall(V2i p)
+static inline TerrainTile
+GetTerrain(V2i p)
 {
-    Entity *e = AddEntity(StringLiteral("Wall"), p, MakeSprite(Glyph_Tone50, MakeColor(110, 165, 100)));
-    SetProperties(e, EntityProperty_Invulnerable|EntityProperty_BlockMovement|EntityProperty_BlockSight);
-    return e;
+    TerrainTile result = {};
+    if (IsInWorld(p))
+    {
+        result = entity_manager->terrain[p.y*entity_manager->world_w + p.x];
+    }
+    return result;
 }
 
-static inline Entity *
-AddDoor(V2i p)
+static inline void
+SetTerrain(V2i p, TerrainKind kind)
 {
-    Entity *e = AddEntity(StringLiteral("Door"), p, MakeSprite('#', MakeColor(127, 64, 0)));
-	e->sprites_locked[0] = MakeSprite('#', MakeColor(255, 127, 0));
+    Assert(IsInWorld(p));
 
-    SetProperties(e, EntityProperty_Invulnerable|EntityProperty_Door|EntityProperty_BlockMovement|EntityProperty_BlockSight);
-    SetContactTrigger(e, Trigger_Unblock);
+    TerrainTile *tile = &entity_manager->terrain[p.y*entity_manager->world_w + p.x];
+    tile->kind = (uint8_t)kind;
+    tile->flags = GetTerrainMaterial(kind).flags;
 
-    return e;
+    UpdateTileBlocking(p);
 }
 
-static inline Entity *
-AddPlayer(V2i p)
+static inline bool
+TileBlocked(V2i p)
 {
-    Entity *e = AddEntity(StringLiteral("Player"), p, MakeSprite('@', MakeColor(255, 255, 0)));
-    SetProperties(e, EntityProperty_BlockMovement|EntityProperty_BlockSight|EntityProperty_HasVisibilityGrid);
-
-    e->health = e->max_health = 100;
-    e->faction = Faction_Human;
-
-    Assert(!entity_manager->player);
-    entity_manager->player = e;
-
-    return e;
+    // NOTE: Outside of the world counts as blocked, there's nowhere to go
+    return !IsInWorld(p) || GetTileBit(&entity_manager->block_movement, p);
 }
 
-static inline Entity *
-AddOrc(V2i p)
+static inline bool
+TileBlocksSight(V2i p)
 {
-    Entity *e = AddEntity(StringLiteral("Orc"), p, MakeSprite('O', MakeColor(126, 192, 95)));
-    e->health = e->max_health = 3;
-    e->speed = 125;
-    e->ai = Ai_StandardHumanoid;
-    e->faction = Faction_Monster;
-    SetProperty(e, EntityProperty_BlockMovement);
-    SetProperty(e, EntityProperty_HasVisibilityGrid);
-    return e;
+    return GetTileBit(&entity_manager->block_sight, p);
 }
 
-static inline Entity *
-AddGold(V2i p, int amount)
+struct EntityStorageArray
 {
-    Entity *e = AddEntity(StringLiteral("Gold"), p, MakeSprite('g', MakeColor(255, 255, 0)));
-    e->amount = amount;
-    e->sprite_anim_rate = 0.25f;
-    e->sprite_anim_pause_time = 1.75f;
-    e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 0));
-    e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 127));
-    e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 255));
-    SetContactTrigger(e, Trigger_PickUp);
-    return e;
-}
+    void **base_at;
+    size_t element_size;
+    uint32_t entities_per_element;
+};
 
-static inline Entity *
-AddChest(V2i p)
+static inline size_t
+GetEntityStorageArrays(EntityStorageArray *arrays)
 {
-    Entity *e = AddEntity(StringLiteral("Chest"), p, MakeSprite('M', MakeColor(64, 127, 0)));
-	e->sprites_locked[0] = MakeSprite('M', MakeColor(127, 255, 0));
-    SetProperties(e, EntityProperty_Invulnerable|EntityProperty_BlockMovement);
-    SetContactTrigger(e, Trigger_Container);
-    return e;
+    size_t count = 0;
+    arrays[count++] = { (void **)&entity_manager->entity_handles,     sizeof(EntityHandle), 1 };
+    arrays[count++] = { (void **)&entity_manager->entity_positions,   sizeof(V2i), 1 };
+    arrays[count++] = { (void **)&entity_manager->entity_properties,  sizeof(EntityPropertySet), 1 };
+    arrays[count++] = { (void **)&entity_manager->entity_speed,       sizeof(int32_t), 1 };
+    arrays[count++] = { (void **)&entity_manager->schedule,           sizeof(ScheduledActor), 1 };
+    arrays[count++] = { (void **)&entity_manager->entities,           sizeof(Entity), 1 };
+    arrays[count++] = { (void **)&entity_manager->free_handles,       sizeof(uint32_t), 1 };
+    arrays[count++] = { (void **)&entity_manager->handle_slots,       sizeof(uint32_t), 1 };
+    arrays[count++] = { (void **)&entity_manager->handle_generations, sizeof(uint32_t), 1 };
+    for (uint32_t property = EntityProperty_None + 1; property < EntityProperty_COUNT; ++property)
+    {
+        EntityIndexSet *set = &entity_manager->property_sets[property];
+        arrays[count++] = { (void **)&set->dense,  sizeof(uint32_t), 1 };
+        arrays[count++] = { (void **)&set->sparse, sizeof(uint32_t), 1 };
+    }
+    arrays[count++] = { (void **)&entity_manager->free_slots, sizeof(uint64_t), 64 };
+    return count;
 }
 
-static inline bool
-EntitiesAreSimilar(Entity *a, Entity *b)
+#define MAX_ENTITY_STORAGE_ARRAYS (9 + 2*EntityProperty_COUNT + 1)
+
+static inline size_t
+GetEntityStorageSize(EntityStorageArray *array, uint32_t capacity)
 {
-    if (a->inventory.first) return false;
-    if (b->inventory.first) return false;
-    if (!AreEqual(a->name, b->name)) return false;
-    if (a->faction != b->faction) return false;
-    if (a->contact_trigger != b->contact_trigger) return false;
-    if (a->required_key != NullEntityHandle()) return false;
-    if (b->required_key != NullEntityHandle()) return false;
-    if (a->uses != b->uses) return false;
-    if (a->health != b->health) return false;
-    if (a->max_health != b->max_health) return false;
-    if (a->speed != b->speed) return false;
-    if (a->sprite_anim_rate != b->sprite_anim_rate) return false;
-    if (a->sprite_count != b->sprite_count) return false;
-    if (!MemoryIsEqual(sizeof(a->sprites), a->sprites, b->sprites)) return false;
-    if (!MemoryIsEqual(sizeof(a->properties), a->properties, b->properties)) return false;
-    return true;
+    size_t size = array->element_size*(capacity / array->entities_per_element);
+    return AlignPow2(size, platform->page_size);
 }
 
 static inline void
-AddToInventory(Entity *e, Entity *item)
+GrowEntityStorage(uint32_t new_capacity)
 {
-    RemoveEntityFromGrid(item);
-    UnsetProperty(item, EntityProperty_InWorld);
+    Assert(new_capacity <= MAX_ENTITY_COUNT);
+    Assert(new_capacity % 64 == 0);
+
+    EntityStorageArray arrays[MAX_ENTITY_STORAGE_ARRAYS];
+    size_t array_count = GetEntityStorageArrays(arrays);
 
-    for (Entity *test_item: Linearize(&e->inventory))
+    for (size_t i = 0; i < array_count; i += 1)
     {
-        if (EntitiesAreSimilar(test_item, item))
+        EntityStorageArray *array = &arrays[i];
+        if (!*array->base_at)
         {
-            test_item->amount += item->amount;
-            return;
+            *array->base_at = platform->ReserveMemory(GetEntityStorageSize(array, MAX_ENTITY_COUNT),
+                                                      PlatformMemFlag_NoLeakCheck, LOCATION_STRING("Entity Storage"));
+        }
+
+        size_t old_size = GetEntityStorageSize(array, entity_manager->entity_capacity);
+        size_t new_size = GetEntityStorageSize(array, new_capacity);
+        if (new_size > old_size)
+        {
+            platform->CommitMemory((uint8_t *)*array->base_at + old_size, new_size - old_size);
         }
     }
 
-    EntityNode *node = NewEntityNode(item->handle);
-    SllQueuePush(e->inventory.first, e->inventory.last, node);
+    entity_manager->entity_capacity = new_capacity;
 }
 
 static inline void
-LockWithKey(Entity *e, Entity *key)
+ReleaseEntityStorage(void)
 {
-    Assert(e->required_key == NullEntityHandle());
-    e->required_key = key->handle;
-    e->locked = true;
-
-    key->uses += 1;
-}
+    EntityStorageArray arrays[MAX_ENTITY_STORAGE_ARRAYS];
+    size_t array_count = GetEntityStorageArrays(arrays);
 
-static inline void
-GiveRandomLoot(Entity *e, RandomSeries *entropy)
-{
-    if (RandomChoice(entropy, 10) == 0)
+    for (size_t i = 0; i < array_count; i += 1)
     {
-        Entity *small_gem = AddEntity("Small Gem"_str, MakeV2i(0, 0), MakeSprite(Glyph_Diamond, MakeColor(0, 127, 255)));
-        SetContactTrigger(small_gem, Trigger_PickUp);
-        AddToInventory(e, small_gem);
+        if (*arrays[i].base_at)
+        {
+            platform->DeallocateMemory(*arrays[i].base_at);
+            *arrays[i].base_at = nullptr;
+        }
     }
 
-    if (!e->inventory.first || RandomChoice(entropy, 4) == 0)
-    {
-        AddToInventory(e, AddGold(MakeV2i(0, 0), RandomRange(entropy, 12, 36)));
-    }
+    entity_manager->entity_capacity = 0;
 }
 
 static inline void
-KillEntity(Entity *e)
+InitializeEntityManager(int world_w, int world_h)
 {
-    V2i p = e->p;
+    GrowEntityStorage(ENTITY_STORAGE_GROW_COUNT);
 
-    UnsetProperty(e, EntityProperty_Alive);
-    RemoveEntityFromGrid(e);
-    if (e == entity_manager->player)
-    {
-        entity_manager->player = &entity_manager->null_entity;
-    }
-    e->next_free = entity_manager->first_free_entity;
-    entity_manager->first_free_entity = e;
+    // NOTE: Slot 0 is the null entity, and handle 0 the null handle
+    entity_manager->entity_count = 1;
+    entity_manager->handle_count = 1;
 
-    for (Entity *item: Pull(&e->inventory))
-    {
-        // Moving entities places them into the world, maybe a bit too much implicit behaviour?
-        MoveEntity(item, e->p);
-    }
-}
+    entity_manager->world_w = world_w;
+    entity_manager->world_h = world_h;
 
-struct EntityIter
-{
-    EntityPropertySet filter;
+    entity_manager->chunk_count_x = (world_w + ENTITY_CHUNK_SIZE - 1) / ENTITY_CHUNK_SIZE;
+    entity_manager->chunk_count_y = (world_h + ENTITY_CHUNK_SIZE - 1) / ENTITY_CHUNK_SIZE;
+    entity_manager->chunks = PushArray(&entity_manager->arena, entity_manager->chunk_count_x*entity_manager->chunk_count_y, EntityChunk *);
+    entity_manager->chunk_pathing_versions = PushArray(&entity_manager->arena, entity_manager->chunk_count_x*entity_manager->chunk_count_y, uint32_t);
 
-    Entity *list;
-    size_t next_offset;
+    InitializeBitplane(&entity_manager->block_movement, world_w, world_h);
+    InitializeBitplane(&entity_manager->block_sight, world_w, world_h);
+    InitializeBitplane(&entity_manager->block_pathing, world_w, world_h);
 
-    Entity *entity;
-};
+    entity_manager->terrain = PushArray(&entity_manager->arena, (size_t)world_w*world_h, TerrainTile);
 
-static inline void Next(EntityIter *iter);
+    entity_manager->active_radius = SIM_ACTIVE_RADIUS;
+    entity_manager->region_count = 1;
+    entity_manager->regions = PushArray(&entity_manager->arena, MAX_SIM_REGIONS, SimRegion);
+    entity_manager->tile_regions = PushArray(&entity_manager->arena, (size_t)world_w*world_h, uint16_t);
 
-static inline EntityIter
-Reset(EntityIter iter)
+    InitializePrefabs();
+}
+
+static inline Entity *
+EntityFromHandle(EntityHandle handle)
+{
+    if (handle.index && (handle.index < entity_manager->handle_count))
+    {
+        uint32_t slot = entity_manager->handle_slots[handle.index];
+        if (slot && (entity_manager->entity_handles[slot] == handle))
+        {
+            return &entity_manager->entities[slot];
+        }
+    }
+    return nullptr;
+}
+
+static inline EntityHandle
+AllocateHandle(uint32_t slot)
 {
-    if (iter.list)
+    uint32_t index = 0;
+    if (entity_manager->free_handle_count)
     {
-        iter.entity = iter.list;
+        index = entity_manager->free_handles[--entity_manager->free_handle_count];
     }
     else
     {
-        iter.entity = entity_manager->entities;
+        Assert(entity_manager->handle_count < entity_manager->entity_capacity);
+        index = entity_manager->handle_count++;
     }
-    return iter;
-}
+
+    EntityHandle result = {};
+    result.index = index;
+    result.generation = ++entity_manager->handle_generations[index];
+
+    entity_manager->handle_slots[index] = slot;
+
+    return result;
+}
+
+static inline void
+FreeHandle(EntityHandle handle)
+{
+    Assert(entity_manager->handle_slots[handle.index]);
+    entity_manager->handle_slots[handle.index] = 0;
+    entity_manager->free_handles[entity_manager->free_handle_count++] = handle.index;
+}
+
+static inline bool
+IsSlotFree(uint32_t slot)
+{
+    return !!(entity_manager->free_slots[slot / 64] & (1ull << (slot % 64)));
+}
+
+static inline uint32_t
+AllocateEntitySlot(void)
+{
+    uint32_t result = 0;
+
+    uint32_t one_past_last_word = (entity_manager->entity_count + 63) / 64;
+    for (uint32_t word_index = entity_manager->lowest_free_slot_word;
+         word_index < one_past_last_word;
+         word_index += 1)
+    {
+        BitScanResult scan = FindLeastSignificantSetBit(entity_manager->free_slots[word_index]);
+        entity_manager->lowest_free_slot_word = word_index;
+        if (scan.found)
+        {
+            result = 64*word_index + scan.index;
+            entity_manager->free_slots[word_index] &= ~(1ull << scan.index);
+            break;
+        }
+    }
+
+    if (!result && (entity_manager->entity_count < MAX_ENTITY_COUNT))
+    {
+        if (entity_manager->entity_count == entity_manager->entity_capacity)
+        {
+            GrowEntityStorage(entity_manager->entity_capacity + ENTITY_STORAGE_GROW_COUNT);
+        }
+        result = entity_manager->entity_count++;
+    }
+
+    return result;
+}
+
+static inline void
+FreeEntitySlot(uint32_t slot)
+{
+    Assert(slot && !IsSlotFree(slot));
+
+    entity_manager->free_slots[slot / 64] |= 1ull << (slot % 64);
+    if (entity_manager->lowest_free_slot_word > slot / 64)
+    {
+        entity_manager->lowest_free_slot_word = slot / 64;
+    }
+
+    // NOTE: Keep the high-water mark tight, free slots at the top just get dropped
+    while ((entity_manager->entity_count > 1) && IsSlotFree(entity_manager->entity_count - 1))
+    {
+        uint32_t top = --entity_manager->entity_count;
+        entity_manager->free_slots[top / 64] &= ~(1ull << (top % 64));
+    }
+}
+
+static inline EntityHandle
+HandleFromEntity(Entity *entity)
+{
+    return entity_manager->entity_handles[EntityIndex(entity)];
+}
+
+static inline bool
+RemoveEntityFromGrid(Entity *e)
+{
+    V2i p = PositionOf(e);
+    Assert(IsInWorld(p));
+    EntityChunk *chunk = GetEntityChunk(p, false);
+    if (!chunk)
+    {
+        return false;
+    }
+
+    for (Entity **it_at = GetChunkTile(chunk, p);
+         *it_at;
+         it_at = &(*it_at)->next_on_tile)
+    {
+        Entity *it = *it_at;
+        if (it == e)
+        {
+            *it_at = it->next_on_tile;
+            it->next_on_tile = nullptr;
+
+            Assert(chunk->occupancy > 0);
+            chunk->occupancy -= 1;
+            Assert(chunk->faction_occupancy[e->faction] > 0);
+            chunk->faction_occupancy[e->faction] -= 1;
+            Assert(chunk->dormant_occupancy >= (uint32_t)e->dormant);
+            chunk->dormant_occupancy -= e->dormant;
+
+            UpdateTileBlocking(p);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool
+MoveEntity(Entity *e, V2i p)
+{
+    Assert(IsInWorld(PositionOf(e)));
+    Assert(IsInWorld(p));
+    if (TileBlocked(p))
+    {
+        return false;
+    }
+
+    RemoveEntityFromGrid(e);
+
+    LinkEntityIntoTile(e, p);
+
+    entity_manager->entity_positions[EntityIndex(e)] = p;
+    SetProperty(e, EntityProperty_InWorld);
+
+    UpdateTileBlocking(p);
+
+    // NOTE: Once something moves away from where the player last saw it, the player has lost
+    // track of it until they get eyes on it again.
+    if (e != entity_manager->player && !AreEqual(p, e->seen_p))
+    {
+        e->seen_by_player = false;
+    }
+
+    return true;
+}
+
+// NOTE: Changing faction has to go through here so the chunk's faction counts stay right.
+static inline void
+SetFaction(Entity *e, FactionKind faction)
+{
+    bool in_grid = HasProperty(e, EntityProperty_InWorld);
+    if (in_grid)
+    {
+        RemoveEntityFromGrid(e);
+    }
+    e->faction = faction;
+    e->stack_signature = 0;
+    if (in_grid)
+    {
+        LinkEntityIntoTile(e, PositionOf(e));
+    }
+}
+
+static inline void
+SetContactTrigger(Entity *e, TriggerKind kind)
+{
+    e->contact_trigger = kind;
+    e->stack_signature = 0;
+}
+
+static inline bool
+ScheduledBefore(const ScheduledActor &a, const ScheduledActor &b)
+{
+    if (a.time != b.time)
+    {
+        return a.time < b.time;
+    }
+    return (int32_t)(a.sequence - b.sequence) < 0;
+}
+
+static inline void
+PlaceInSchedule(uint32_t heap_index, ScheduledActor actor)
+{
+    entity_manager->schedule[heap_index] = actor;
+    EntityFromHandle(actor.handle)->schedule_index = heap_index + 1;
+}
+
+static inline void
+SiftScheduleUp(uint32_t heap_index)
+{
+    ScheduledActor actor = entity_manager->schedule[heap_index];
+    while (heap_index > 0)
+    {
+        uint32_t parent_index = (heap_index - 1) / 2;
+        ScheduledActor parent = entity_manager->schedule[parent_index];
+        if (!ScheduledBefore(actor, parent))
+        {
+            break;
+        }
+        PlaceInSchedule(heap_index, parent);
+        heap_index = parent_index;
+    }
+    PlaceInSchedule(heap_index, actor);
+}
+
+static inline void
+SiftScheduleDown(uint32_t heap_index)
+{
+    ScheduledActor *schedule = entity_manager->schedule;
+    uint32_t count = entity_manager->schedule_count;
+
+    ScheduledActor actor = schedule[heap_index];
+    for (;;)
+    {
+        uint32_t child_index = 2*heap_index + 1;
+        if (child_index >= count)
+        {
+            break;
+        }
+        if ((child_index + 1 < count) && ScheduledBefore(schedule[child_index + 1], schedule[child_index]))
+        {
+            child_index += 1;
+        }
+        if (!ScheduledBefore(schedule[child_index], actor))
+        {
+            break;
+        }
+        PlaceInSchedule(heap_index, schedule[child_index]);
+        heap_index = child_index;
+    }
+    PlaceInSchedule(heap_index, actor);
+}
+
+// NOTE: Restores the heap after the actor at heap_index got a new time, whichever way it moved.
+static inline void
+ResiftSchedule(uint32_t heap_index)
+{
+    EntityHandle handle = entity_manager->schedule[heap_index].handle;
+    SiftScheduleUp(heap_index);
+    SiftScheduleDown(EntityFromHandle(handle)->schedule_index - 1);
+}
+
+static inline uint64_t
+GetActionDelay(Entity *e)
+{
+    Assert(SpeedOf(e) > 0);
+    uint64_t result = (uint64_t)ENTITY_TURN_TICKS*100 / (uint64_t)SpeedOf(e);
+    return result;
+}
+
+static inline void
+ScheduleEntity(Entity *e, uint64_t time)
+{
+    ScheduledActor actor = {};
+    actor.time = time;
+    actor.sequence = entity_manager->schedule_sequence++;
+    actor.handle = HandleFromEntity(e);
+
+    if (e->schedule_index)
+    {
+        uint32_t heap_index = e->schedule_index - 1;
+        PlaceInSchedule(heap_index, actor);
+        ResiftSchedule(heap_index);
+    }
+    else
+    {
+        Assert(entity_manager->schedule_count < entity_manager->entity_capacity);
+        uint32_t heap_index = entity_manager->schedule_count++;
+        PlaceInSchedule(heap_index, actor);
+        SiftScheduleUp(heap_index);
+    }
+}
+
+static inline void
+UnscheduleEntity(Entity *e)
+{
+    if (!e->schedule_index)
+    {
+        return;
+    }
+
+    uint32_t heap_index = e->schedule_index - 1;
+    e->schedule_index = 0;
+
+    uint32_t last_index = --entity_manager->schedule_count;
+    if (heap_index != last_index)
+    {
+        PlaceInSchedule(heap_index, entity_manager->schedule[last_index]);
+        ResiftSchedule(heap_index);
+    }
+}
+
+static inline uint64_t
+GetScheduledTime(Entity *e)
+{
+    Assert(e->schedule_index);
+    return entity_manager->schedule[e->schedule_index - 1].time;
+}
+
+// NOTE: Puts an entity that should take turns into the schedule, to act one action delay from now.
+static inline void
+ScheduleActor(Entity *e)
+{
+    if (SpeedOf(e) > 0)
+    {
+        ScheduleEntity(e, entity_manager->schedule_time + GetActionDelay(e));
+    }
+}
+
+static inline bool
+IsActor(Entity *e)
+{
+    return (e->ai != Ai_None) || (e == entity_manager->player);
+}
+
+// NOTE: Speed changes take effect right away, whatever is left of the current wait gets
+// stretched or shrunk to match the new speed.
+static inline void
+SetSpeed(Entity *e, int32_t speed)
+{
+    int32_t old_speed = SpeedOf(e);
+    entity_manager->entity_speed[EntityIndex(e)] = speed;
+
+    if (!e->schedule_index)
+    {
+        if (IsActor(e) && !e->dormant)
+        {
+            ScheduleActor(e);
+        }
+    }
+    else
+    {
+        if (speed <= 0)
+        {
+            UnscheduleEntity(e);
+        }
+        else
+        {
+            uint64_t now = entity_manager->schedule_time;
+            uint64_t time = GetScheduledTime(e);
+            uint64_t remaining = (time > now ? time - now : 0);
+            ScheduleEntity(e, now + remaining*(uint64_t)old_speed / (uint64_t)speed);
+        }
+    }
+}
+
+// NOTE: Marks out a region for UpdateSimulationRegions (worldgen makes one per room). Tiles
+// can only be in one region, later regions win.
+static inline uint16_t
+AddSimRegion(Rect2i rect)
+{
+    uint16_t result = 0;
+
+    rect = Intersect(rect, 0, 0, entity_manager->world_w, entity_manager->world_h);
+    if (entity_manager->region_count < MAX_SIM_REGIONS)
+    {
+        result = (uint16_t)entity_manager->region_count++;
+
+        SimRegion *region = &entity_manager->regions[result];
+        region->rect = rect;
+
+        for (int y = rect.min.y; y < rect.max.y; ++y)
+        for (int x = rect.min.x; x < rect.max.x; ++x)
+        {
+            entity_manager->tile_regions[y*entity_manager->world_w + x] = result;
+        }
+    }
+
+    return result;
+}
+
+static inline SimRegion *
+GetSimRegion(V2i p)
+{
+    SimRegion *result = nullptr;
+    if (IsInWorld(p))
+    {
+        uint16_t index = entity_manager->tile_regions[p.y*entity_manager->world_w + p.x];
+        if (index)
+        {
+            result = &entity_manager->regions[index];
+        }
+    }
+    return result;
+}
+
+static inline void
+MakeDormant(Entity *e)
+{
+    Assert(!e->dormant && e->schedule_index && (e != entity_manager->player));
+
+    e->dormant = true;
+    e->dormant_resume_time = GetScheduledTime(e);
+    UnscheduleEntity(e);
+
+    if (HasProperty(e, EntityProperty_InWorld))
+    {
+        EntityChunk *chunk = GetEntityChunk(PositionOf(e), false);
+        chunk->dormant_occupancy += 1;
+    }
+}
+
+// NOTE: Nothing gets simulated while an entity is dormant, so catching up is coarse: it skips
+// the actions it slept through and picks up its old rhythm from wherever that lands it.
+static inline void
+WakeEntity(Entity *e)
+{
+    if (!e->dormant)
+    {
+        return;
+    }
+
+    e->dormant = false;
+
+    if (HasProperty(e, EntityProperty_InWorld))
+    {
+        EntityChunk *chunk = GetEntityChunk(PositionOf(e), false);
+        Assert(chunk->dormant_occupancy > 0);
+        chunk->dormant_occupancy -= 1;
+    }
+
+    if (SpeedOf(e) > 0)
+    {
+        uint64_t now = entity_manager->schedule_time;
+        uint64_t time = e->dormant_resume_time;
+        if (time <= now)
+        {
+            uint64_t delay = GetActionDelay(e);
+            time += ((now - time) / delay + 1)*delay;
+        }
+        ScheduleEntity(e, time);
+    }
+}
+
+static inline void
+WakeDormantEntities(Rect2i rect)
+{
+    rect = Intersect(rect, 0, 0, entity_manager->world_w, entity_manager->world_h);
+    if ((rect.min.x >= rect.max.x) || (rect.min.y >= rect.max.y))
+    {
+        return;
+    }
+
+    int chunk_min_x = rect.min.x >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_min_y = rect.min.y >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_x = (rect.max.x - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_y = (rect.max.y - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+
+    for (int chunk_y = chunk_min_y; chunk_y <= chunk_max_y; chunk_y += 1)
+    for (int chunk_x = chunk_min_x; chunk_x <= chunk_max_x; chunk_x += 1)
+    {
+        EntityChunk *chunk = entity_manager->chunks[chunk_y*entity_manager->chunk_count_x + chunk_x];
+        if (!chunk || !chunk->dormant_occupancy)
+        {
+            continue;
+        }
+
+        Rect2i chunk_rect = Intersect(rect,
+                                      chunk_x << ENTITY_CHUNK_SIZE_LOG2,
+                                      chunk_y << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_x + 1) << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_y + 1) << ENTITY_CHUNK_SIZE_LOG2);
+
+        for (int y = chunk_rect.min.y; y < chunk_rect.max.y; y += 1)
+        for (int x = chunk_rect.min.x; x < chunk_rect.max.x; x += 1)
+        {
+            for (Entity *e = *GetChunkTile(chunk, MakeV2i(x, y)); e; e = e->next_on_tile)
+            {
+                WakeEntity(e);
+            }
+        }
+    }
+}
+
+// NOTE: Wakes up anything dormant within a square of the given radius, for fights and other
+// loud things.
+static inline void
+MakeNoise(V2i p, int radius)
+{
+    WakeDormantEntities(MakeRect2iMinMax(p - MakeV2i(radius, radius), p + MakeV2i(radius + 1, radius + 1)));
+}
+
+static inline EntityPrefab
+MakePrefab(String name, Sprite sprite, EntityPropertySet properties = {})
+{
+    EntityPrefab result = {};
+    result.properties = properties;
+    result.speed = 100;
+
+    Entity *e = &result.image;
+    e->name = name;
+    e->health = 2;
+    e->sprites[e->sprite_count++] = sprite;
+    e->amount = 1;
+    e->view_radius = 24.0f;
+
+    return result;
+}
+
+static inline void
+InitializePrefabs(void)
+{
+    EntityPrefab *prefabs = entity_manager->prefabs;
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_Door];
+        *prefab = MakePrefab(StringLiteral("Door"), MakeSprite('#', MakeColor(127, 64, 0)),
+                             PropertyMask<EntityProperty_Invulnerable, EntityProperty_Door, EntityProperty_BlockMovement, EntityProperty_BlockSight>);
+        prefab->image.sprites_locked[0] = MakeSprite('#', MakeColor(255, 127, 0));
+        prefab->image.contact_trigger = Trigger_Unblock;
+    }
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_Player];
+        *prefab = MakePrefab(StringLiteral("Player"), MakeSprite('@', MakeColor(255, 255, 0)),
+                             PropertyMask<EntityProperty_BlockMovement, EntityProperty_BlockSight, EntityProperty_HasVisibilityGrid>);
+        prefab->image.health = prefab->image.max_health = 100;
+        prefab->image.faction = Faction_Human;
+    }
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_Orc];
+        *prefab = MakePrefab(StringLiteral("Orc"), MakeSprite('O', MakeColor(126, 192, 95)),
+                             PropertyMask<EntityProperty_BlockMovement, EntityProperty_HasVisibilityGrid>);
+        prefab->speed = 125;
+        prefab->image.health = prefab->image.max_health = 3;
+        prefab->image.ai = Ai_StandardHumanoid;
+        prefab->image.faction = Faction_Monster;
+    }
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_Gold];
+        *prefab = MakePrefab(StringLiteral("Gold"), MakeSprite('g', MakeColor(255, 255, 0)));
+        Entity *e = &prefab->image;
+        e->sprite_anim_rate = 0.25f;
+        e->sprite_anim_pause_time = 1.75f;
+        e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 0));
+        e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 127));
+        e->sprites[e->sprite_count++] = MakeSprite('g', MakeColor(255, 255, 255));
+        e->contact_trigger = Trigger_PickUp;
+    }
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_Chest];
+        *prefab = MakePrefab(StringLiteral("Chest"), MakeSprite('M', MakeColor(64, 127, 0)),
+                             PropertyMask<EntityProperty_Invulnerable, EntityProperty_BlockMovement>);
+        prefab->image.sprites_locked[0] = MakeSprite('M', MakeColor(127, 255, 0));
+        prefab->image.contact_trigger = Trigger_Container;
+    }
+
+    {
+        EntityPrefab *prefab = &prefabs[Prefab_SmallGem];
+        *prefab = MakePrefab(StringLiteral("Small Gem"), MakeSprite(Glyph_Diamond, MakeColor(0, 127, 255)));
+        prefab->image.contact_trigger = Trigger_PickUp;
+    }
+}
+
+// NOTE: Spawns a copy of the prefab at each of the positions, linking them into the grid as
+// it goes. Like MoveEntity, an entity whose tile is blocked still gets spawned but stays out
+// of the world, which is how items destined for an inventory get made. Returns how many
+// entities were spawned, which is less than count if we ran out of slots.
+static inline size_t
+SpawnBatch(EntityPrefab *prefab, V2i *positions, size_t count, Entity **out_entities = nullptr)
+{
+    EntityPropertySet properties = prefab->properties | EntityProperty_Alive;
+
+    size_t spawned_count = 0;
+    for (; spawned_count < count; spawned_count += 1)
+    {
+        uint32_t index = AllocateEntitySlot();
+        if (!index)
+        {
+            break;
+        }
+
+        V2i p = positions[spawned_count];
+        Assert(IsInWorld(p));
+
+        Entity *e = &entity_manager->entities[index];
+        CopyStruct(&prefab->image, e);
+
+        entity_manager->entity_handles[index] = AllocateHandle(index);
+        entity_manager->entity_positions[index] = p;
+        entity_manager->entity_properties[index] = {};
+        entity_manager->entity_speed[index] = prefab->speed;
+
+        EntityPropertySet e_properties = properties;
+        if (!TileBlocked(p))
+        {
+            LinkEntityIntoTile(e, p);
+            e_properties |= EntityProperty_InWorld;
+        }
+
+        // NOTE: This also updates the blocking bitplanes if the prefab blocks
+        ChangeProperties(e, e_properties);
+
+        if (e->ai != Ai_None)
+        {
+            ScheduleActor(e);
+        }
+
+        if (out_entities)
+        {
+            out_entities[spawned_count] = e;
+        }
+    }
+
+    return spawned_count;
+}
+
+static inline Entity *
+SpawnEntity(EntityPrefab *prefab, V2i p)
+{
+    Entity *result = nullptr;
+    SpawnBatch(prefab, &p, 1, &result);
+    return result;
+}
+
+static inline Entity *
+SpawnEntity(PrefabKind kind, V2i p)
+{
+    return SpawnEntity(&entity_manager->prefabs[kind], p);
+}
+
+static inline Entity *
+AddEntity(String name, V2i p, Sprite sprite, EntityPropertySet initial_properties = {})
+{
+    EntityPrefab prefab = MakePrefab(name, sprite, initial_properties);
+    return SpawnEntity(&prefab, p);
+}
+
+static inline Entity *
+AddDoor(V2i p)
+{
+    return SpawnEntity(Prefab_Door, p);
+}
+
+static inline Entity *
+AddPlayer(V2i p)
+{
+    Entity *e = SpawnEntity(Prefab_Player, p);
+
+    Assert(!entity_manager->player);
+    entity_manager->player = e;
+    ScheduleActor(e);
+
+    // NOTE: Now that it's known to be the player it no longer blocks pathing
+    UpdateTileBlocking(PositionOf(e));
+
+    return e;
+}
+
+static inline Entity *
+AddOrc(V2i p)
+{
+    return SpawnEntity(Prefab_Orc, p);
+}
+
+static inline Entity *
+AddGold(V2i p, int amount)
+{
+    Entity *e = SpawnEntity(Prefab_Gold, p);
+    e->amount = amount;
+    return e;
+}
+
+static inline Entity *
+AddChest(V2i p)
+{
+    return SpawnEntity(Prefab_Chest, p);
+}
+
+static inline bool
+EntitiesAreSimilar(Entity *a, Entity *b)
+{
+    if (a->inventory.count) return false;
+    if (b->inventory.count) return false;
+    if (!AreEqual(a->name, b->name)) return false;
+    if (a->faction != b->faction) return false;
+    if (a->contact_trigger != b->contact_trigger) return false;
+    if (a->required_key != NullEntityHandle()) return false;
+    if (b->required_key != NullEntityHandle()) return false;
+    if (a->uses != b->uses) return false;
+    if (a->health != b->health) return false;
+    if (a->max_health != b->max_health) return false;
+    if (SpeedOf(a) != SpeedOf(b)) return false;
+    if (a->sprite_anim_rate != b->sprite_anim_rate) return false;
+    if (a->sprite_count != b->sprite_count) return false;
+    if (!MemoryIsEqual(sizeof(a->sprites), a->sprites, b->sprites)) return false;
+    if (!MemoryIsEqual(sizeof(EntityPropertySet), PropertiesOf(a), PropertiesOf(b))) return false;
+    return true;
+}
+
+static inline uint64_t
+GetStackSignature(Entity *e)
+{
+    if (!e->stack_signature)
+    {
+        HashResult hash = HashString(e->name);
+        hash = HashData(hash, sizeof(e->faction), &e->faction);
+        hash = HashData(hash, sizeof(e->contact_trigger), &e->contact_trigger);
+        hash = HashData(hash, sizeof(e->sprite_count), &e->sprite_count);
+        hash = HashData(hash, sizeof(e->sprites), e->sprites);
+
+        EntityPropertySet properties = *PropertiesOf(e);
+        for (size_t page = 0; page < EntityProperty_PAGECOUNT; ++page)
+        {
+            properties.properties[page] &= ~stack_unhashed_properties.properties[page];
+        }
+        hash = HashData(hash, sizeof(properties), &properties);
+
+        // NOTE: 0 is reserved for "not computed"
+        e->stack_signature = hash.u64[0] ? hash.u64[0] : 1;
+    }
+    return e->stack_signature;
+}
+
+static inline uint32_t
+GetStackIndexSizeClass(uint32_t capacity)
+{
+    uint32_t result = FindLeastSignificantSetBit(capacity / STACK_INDEX_MIN_CAPACITY).index;
+    Assert(result < ENTITY_LIST_SIZE_CLASS_COUNT);
+    return result;
+}
+
+static inline void
+FreeStackIndex(StackIndex *index)
+{
+    if (index->capacity)
+    {
+        EntityListFreeBlock *block = (EntityListFreeBlock *)index->slots;
+        SllStackPush(entity_manager->free_stack_index_blocks[GetStackIndexSizeClass(index->capacity)], block);
+    }
+    ZeroStruct(index);
+}
+
+// NOTE: Takes the first slot along the probe sequence that's never been used or holds a dead
+// item. There has to be room, see RebuildStackIndex.
+static inline void
+InsertIntoStackIndex(StackIndex *index, uint64_t signature, EntityHandle item)
+{
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t at = (uint32_t)signature & mask;; at = (at + 1) & mask)
+    {
+        StackIndexSlot *slot = &index->slots[at];
+        if (!slot->signature || !EntityFromHandle(slot->item))
+        {
+            index->used_count += !slot->signature;
+            slot->signature = signature;
+            slot->item = item;
+            break;
+        }
+    }
+}
+
+// NOTE: Starts the index over from the inventory, at twice the size it needs
+static inline void
+RebuildStackIndex(Entity *e)
+{
+    StackIndex *index = &e->inventory_stack_index;
+    FreeStackIndex(index);
+
+    uint32_t capacity = STACK_INDEX_MIN_CAPACITY;
+    while (capacity < 2*e->inventory.count)
+    {
+        capacity *= 2;
+    }
+
+    EntityListFreeBlock **free_list = &entity_manager->free_stack_index_blocks[GetStackIndexSizeClass(capacity)];
+    if (*free_list)
+    {
+        index->slots = (StackIndexSlot *)SllStackPop(*free_list);
+    }
+    else
+    {
+        index->slots = PushArrayNoClear(&entity_manager->arena, capacity, StackIndexSlot);
+    }
+    ZeroArray(capacity, index->slots);
+    index->capacity = capacity;
+
+    for (EntityListIter iter = IterateList(&e->inventory); IsValid(iter); Next(&iter))
+    {
+        InsertIntoStackIndex(index, GetStackSignature(iter.entity), HandleFromEntity(iter.entity));
+    }
+}
+
+static inline void
+RemoveFromStackIndex(StackIndex *index, Entity *item)
+{
+    if (!index->capacity || !item)
+    {
+        return;
+    }
+
+    EntityHandle handle = HandleFromEntity(item);
+    uint32_t mask = index->capacity - 1;
+    uint64_t signature = GetStackSignature(item);
+    for (uint32_t at = (uint32_t)signature & mask; index->slots[at].signature; at = (at + 1) & mask)
+    {
+        if (index->slots[at].item == handle)
+        {
+            index->slots[at].item = NullEntityHandle();
+            return;
+        }
+    }
+
+    // NOTE: The item's signature changed since it went in, so it's somewhere else
+    for (uint32_t at = 0; at < index->capacity; ++at)
+    {
+        if (index->slots[at].item == handle)
+        {
+            index->slots[at].item = NullEntityHandle();
+            return;
+        }
+    }
+}
+
+// NOTE: The item in e's inventory that item would stack onto, if there is one
+static inline Entity *
+FindInventoryStack(Entity *e, Entity *item, uint64_t signature)
+{
+    StackIndex *index = &e->inventory_stack_index;
+    if (!index->capacity)
+    {
+        for (EntityListIter iter = IterateList(&e->inventory); IsValid(iter); Next(&iter))
+        {
+            Entity *test_item = iter.entity;
+            if ((GetStackSignature(test_item) == signature) && EntitiesAreSimilar(test_item, item))
+            {
+                return test_item;
+            }
+        }
+        return nullptr;
+    }
+
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t at = (uint32_t)signature & mask; index->slots[at].signature; at = (at + 1) & mask)
+    {
+        StackIndexSlot *slot = &index->slots[at];
+        if (slot->signature == signature)
+        {
+            Entity *test_item = EntityFromHandle(slot->item);
+            if (test_item && EntitiesAreSimilar(test_item, item))
+            {
+                return test_item;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static inline void
+AddToInventory(Entity *e, Entity *item)
+{
+    RemoveEntityFromGrid(item);
+    UnsetProperty(item, EntityProperty_InWorld);
+
+    // NOTE: The signature weeds out the items that can't possibly stack with a single compare,
+    // EntitiesAreSimilar still has the final say (and checks the fields that aren't hashed).
+    uint64_t signature = GetStackSignature(item);
+    Entity *stack = FindInventoryStack(e, item, signature);
+    if (stack)
+    {
+        stack->amount += item->amount;
+        return;
+    }
+
+    AddToList(&e->inventory, HandleFromEntity(item));
+
+    // NOTE: Inline inventories are walked, there's only ENTITY_LIST_INLINE_COUNT items in them
+    StackIndex *index = &e->inventory_stack_index;
+    if (e->inventory.capacity)
+    {
+        if (!index->capacity || (4*(index->used_count + 1) > 3*index->capacity))
+        {
+            RebuildStackIndex(e);
+        }
+        else
+        {
+            InsertIntoStackIndex(index, signature, HandleFromEntity(item));
+        }
+    }
+}
+
+static inline void
+LockWithKey(Entity *e, Entity *key)
+{
+    Assert(e->required_key == NullEntityHandle());
+    e->required_key = HandleFromEntity(key);
+    e->locked = true;
+
+    key->uses += 1;
+}
+
+static inline void
+GiveRandomLoot(Entity *e, RandomSeries *entropy)
+{
+    if (RandomChoice(entropy, 10) == 0)
+    {
+        AddToInventory(e, SpawnEntity(Prefab_SmallGem, MakeV2i(0, 0)));
+    }
+
+    if (!e->inventory.count || RandomChoice(entropy, 4) == 0)
+    {
+        AddToInventory(e, AddGold(MakeV2i(0, 0), RandomRange(entropy, 12, 36)));
+    }
+}
+
+static inline void
+AddTombstone(EntityHandle handle)
+{
+    if (entity_manager->tombstone_count < ENTITY_TOMBSTONE_JOURNAL_SIZE)
+    {
+        entity_manager->tombstones[entity_manager->tombstone_count] = handle;
+    }
+    entity_manager->tombstone_count += 1;
+}
+
+static inline void
+KillEntity(Entity *e)
+{
+    V2i p = PositionOf(e);
+
+    UnsetProperty(e, EntityProperty_Alive);
+    RemoveEntityFromGrid(e);
+    UnscheduleEntity(e);
+    if (e == entity_manager->player)
+    {
+        entity_manager->player = GetNullEntity();
+    }
+    AddTombstone(HandleFromEntity(e));
+    FreeHandle(HandleFromEntity(e));
+    FreeEntitySlot(EntityIndex(e));
+
+    for (EntityListIter iter = IterateList(&e->inventory); IsValid(iter); Next(&iter))
+    {
+        // Moving entities places them into the world, maybe a bit too much implicit behaviour?
+        MoveEntity(iter.entity, p);
+    }
+
+    FreeList(&e->inventory);
+    FreeStackIndex(&e->inventory_stack_index);
+    FreeList(&e->forced_hostile_entities);
+}
+
+struct EntityFragmentation
+{
+    uint32_t live_count;
+    uint32_t high_water;
+    float live_ratio;
+};
+
+static inline EntityFragmentation
+GetEntityFragmentation(void)
+{
+    EntityFragmentation result = {};
+    result.live_count = entity_manager->property_sets[EntityProperty_Alive].count;
+    result.high_water = entity_manager->entity_count - 1;
+    result.live_ratio = (result.high_water ? (float)result.live_count / (float)result.high_water : 1.0f);
+    return result;
+}
+
+static inline void
+RelocateEntity(uint32_t from_index, uint32_t to_index)
+{
+    Entity *from = &entity_manager->entities[from_index];
+    Entity *to = &entity_manager->entities[to_index];
+
+    // NOTE: Whoever points at us on our tile needs to point at the new slot
+    if (Entity **head = GetTileListHead(PositionOf(from), false))
+    {
+        for (Entity **it_at = head; *it_at; it_at = &(*it_at)->next_on_tile)
+        {
+            if (*it_at == from)
+            {
+                *it_at = to;
+                break;
+            }
+        }
+    }
+
+    *to = *from;
+
+    EntityHandle handle = entity_manager->entity_handles[from_index];
+    entity_manager->entity_handles[to_index] = handle;
+    entity_manager->entity_positions[to_index] = entity_manager->entity_positions[from_index];
+    entity_manager->entity_properties[to_index] = entity_manager->entity_properties[from_index];
+    entity_manager->entity_speed[to_index] = entity_manager->entity_speed[from_index];
+
+    entity_manager->handle_slots[handle.index] = to_index;
+
+    for (uint32_t property = EntityProperty_None + 1; property < EntityProperty_COUNT; ++property)
+    {
+        EntityIndexSet *set = &entity_manager->property_sets[property];
+        if (IsInSet(set, from_index))
+        {
+            RelocateInSet(set, from_index, to_index);
+        }
+    }
+
+    if (entity_manager->player == from) entity_manager->player = to;
+    if (entity_manager->light_source == from) entity_manager->light_source = to;
+    if (entity_manager->looking_at_container == from) entity_manager->looking_at_container = to;
+}
+
+// NOTE: Moves live entities from the top of the slot array down into the free slots until
+// the live set is a dense prefix. This invalidates any Entity pointers held across the call
+// other than the ones on the EntityManager, so only do it between turns. Handles are fine.
+static inline void
+CompactEntities(void)
+{
+    ProfileScope();
+
+    for (;;)
+    {
+        uint32_t to_index = AllocateEntitySlot();
+        uint32_t from_index = entity_manager->entity_count - 1;
+        if (to_index >= from_index)
+        {
+            // NOTE: No holes left, AllocateEntitySlot had to grow (or couldn't), give it back
+            if (to_index)
+            {
+                FreeEntitySlot(to_index);
+            }
+            break;
+        }
+
+        RelocateEntity(from_index, to_index);
+        FreeEntitySlot(from_index);
+
+        entity_manager->compaction_moved_count += 1;
+    }
+
+    entity_manager->compaction_count += 1;
+}
+
+static inline void
+MaybeCompactEntities(void)
+{
+    EntityFragmentation fragmentation = GetEntityFragmentation();
+    if ((fragmentation.high_water >= 256) &&
+        (fragmentation.live_ratio < ENTITY_COMPACTION_THRESHOLD))
+    {
+        CompactEntities();
+    }
+}
+
+struct EntityIter
+{
+    EntityPropertySet filter;
+
+    Entity *list;
+    size_t next_offset;
+
+    EntityIndexSet *set;
+    uint32_t set_at;
+
+    Entity *entity;
+};
+
+static inline void Next(EntityIter *iter);
 
 static inline EntityIter
 IterateAllEntities(EntityPropertySet filter = {})
 {
-    EntityPropertySet must_filter = {};
-
     EntityIter result = {};
-    result.filter = SetProperty(result.filter, EntityProperty_Alive);
-    result.filter = CombineSet(result.filter, filter);
-    result.entity = entity_manager->entities;
+    result.filter = PropertyMask<EntityProperty_Alive> | filter;
 
-    if (!HasProperties(result.entity, result.filter))
+    // NOTE: Walk the smallest property set in the filter, the rest of the filter gets tested
+    // per member.
+    result.set = &entity_manager->property_sets[EntityProperty_Alive];
+    for (uint32_t property = EntityProperty_None + 1; property < EntityProperty_COUNT; ++property)
     {
-        Next(&result);
+        EntityIndexSet *set = &entity_manager->property_sets[property];
+        if (HasProperty(&result.filter, (EntityPropertyKind)property) &&
+            (set->count < result.set->count))
+        {
+            result.set = set;
+        }
     }
 
+    // NOTE: Sets are walked back to front, so that removing the current entity from the set
+    // (by killing it, say) doesn't make us skip anything. Entities added while iterating
+    // are not visited.
+    result.set_at = result.set->count;
+    result.entity = GetNullEntity();
+    Next(&result);
+
     return result;
 }
 
@@ -470,11 +1619,8 @@ IterateAllEntities(EntityPropertyKind prop)
 static inline EntityIter
 IterateEntityList_(Entity *list, size_t next_offset, EntityPropertySet filter = {})
 {
-    EntityPropertySet must_filter = {};
-
     EntityIter result = {};
-    result.filter = SetProperty(result.filter, EntityProperty_Alive);
-    result.filter = CombineSet(result.filter, filter);
+    result.filter = PropertyMask<EntityProperty_Alive> | filter;
 
     result.list = list;
     result.next_offset = next_offset;
@@ -506,93 +1652,329 @@ IsValid(const EntityIter &iter)
 static inline void
 Next(EntityIter *iter)
 {
-    Entity *end = entity_manager->entities + entity_manager->entity_count;
-
-    while (iter->entity)
+    if (iter->list)
     {
-        if (iter->list)
+        while (iter->entity)
         {
             iter->entity = *(Entity **)((char *)iter->entity + iter->next_offset);
+            if (HasProperties(iter->entity, iter->filter))
+            {
+                break;
+            }
         }
-        else
+    }
+    else
+    {
+        EntityIndexSet *set = iter->set;
+        EntityPropertySet *properties = entity_manager->entity_properties;
+
+        iter->entity = nullptr;
+        while (iter->set_at > 0)
+        {
+            iter->set_at -= 1;
+
+            uint32_t index = set->dense[iter->set_at];
+            if (HasProperties(&properties[index], iter->filter))
+            {
+                iter->entity = &entity_manager->entities[index];
+                break;
+            }
+        }
+    }
+}
+
+static inline EntityArray
+GetEntitiesAt(V2i p, EntityPropertySet filter = {})
+{
+    EntityArray result = {};
+    if (IsInWorld(p))
+    {
+        Entity *list = GetEntitesOnTile(p);
+
+        size_t count = 0;
+        for (Entity *e = list; e; e = e->next_on_tile)
+        {
+            if (HasProperties(e, filter))
+            {
+                count += 1;
+            }
+        }
+
+        result = PushArrayContainer<Entity *>(platform->GetTempArena(), count);
+
+        for (Entity *e = list; e; e = e->next_on_tile)
+        {
+            if (HasProperties(e, filter))
+            {
+                Push(&result, e);
+            }
+        }
+    }
+    return result;
+}
+
+//
+// NOTE: Spatial queries over the entity grid. These only see entities that are in the world.
+// Empty chunks are skipped outright, and the occupancy of the chunks that do get visited
+// bounds the result count, so results go into a single allocation on the caller's arena.
+//
+
+static inline EntityArray
+QueryRect(Arena *arena, Rect2i rect, EntityPropertySet filter = {})
+{
+    EntityArray result = {};
+
+    rect = Intersect(rect, 0, 0, entity_manager->world_w, entity_manager->world_h);
+    if ((rect.min.x >= rect.max.x) || (rect.min.y >= rect.max.y))
+    {
+        return result;
+    }
+
+    int chunk_min_x = rect.min.x >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_min_y = rect.min.y >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_x = (rect.max.x - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_y = (rect.max.y - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+
+    size_t max_count = 0;
+    for (int chunk_y = chunk_min_y; chunk_y <= chunk_max_y; chunk_y += 1)
+    for (int chunk_x = chunk_min_x; chunk_x <= chunk_max_x; chunk_x += 1)
+    {
+        EntityChunk *chunk = entity_manager->chunks[chunk_y*entity_manager->chunk_count_x + chunk_x];
+        if (chunk)
+        {
+            max_count += chunk->occupancy;
+        }
+    }
+
+    result = PushArrayContainer<Entity *>(arena, max_count);
+
+    for (int chunk_y = chunk_min_y; chunk_y <= chunk_max_y; chunk_y += 1)
+    for (int chunk_x = chunk_min_x; chunk_x <= chunk_max_x; chunk_x += 1)
+    {
+        EntityChunk *chunk = entity_manager->chunks[chunk_y*entity_manager->chunk_count_x + chunk_x];
+        if (!chunk || !chunk->occupancy)
+        {
+            continue;
+        }
+
+        Rect2i chunk_rect = Intersect(rect,
+                                      chunk_x << ENTITY_CHUNK_SIZE_LOG2,
+                                      chunk_y << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_x + 1) << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_y + 1) << ENTITY_CHUNK_SIZE_LOG2);
+        for (int y = chunk_rect.min.y; y < chunk_rect.max.y; y += 1)
+        for (int x = chunk_rect.min.x; x < chunk_rect.max.x; x += 1)
+        {
+            for (Entity *e = *GetChunkTile(chunk, MakeV2i(x, y)); e; e = e->next_on_tile)
+            {
+                if (HasProperties(e, filter))
+                {
+                    Push(&result, e);
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+static inline EntityArray
+QueryRadius(Arena *arena, V2i center, int radius, EntityPropertySet filter = {})
+{
+    Rect2i rect = MakeRect2iMinMax(center - MakeV2i(radius, radius), center + MakeV2i(radius + 1, radius + 1));
+    EntityArray result = QueryRect(arena, rect, filter);
+
+    uint32_t radius_sq = (uint32_t)(radius*radius);
+
+    size_t keep_count = 0;
+    for (size_t i = 0; i < result.count; i += 1)
+    {
+        Entity *e = result.data[i];
+        if (LengthSq(PositionOf(e) - center) <= radius_sq)
+        {
+            result.data[keep_count++] = e;
+        }
+    }
+    result.count = keep_count;
+
+    return result;
+}
+
+// NOTE: Returns up to k entities, nearest first. Searches a square around the center that
+// doubles in size until it has seen k entities within its inscribed circle, anything outside
+// the square is further away than that so the answer can't change any more.
+static inline EntityArray
+QueryKNearest(Arena *arena, V2i center, size_t k, EntityPropertySet filter = {})
+{
+    EntityArray result = PushArrayContainer<Entity *>(arena, k);
+    if (!k)
+    {
+        return result;
+    }
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    uint32_t *result_dist_sq = PushArrayNoClear(temp_arena, k, uint32_t);
+
+    for (int radius = ENTITY_CHUNK_SIZE / 2;; radius *= 2)
+    {
+        ScopedMemory candidates_temp(temp_arena);
+
+        Rect2i rect = MakeRect2iMinMax(center - MakeV2i(radius, radius), center + MakeV2i(radius + 1, radius + 1));
+        bool covers_world = ((rect.min.x <= 0) &&
+                             (rect.min.y <= 0) &&
+                             (rect.max.x >= entity_manager->world_w) &&
+                             (rect.max.y >= entity_manager->world_h));
+
+        EntityArray candidates = QueryRect(temp_arena, rect, filter);
+
+        uint32_t radius_sq = (uint32_t)(radius*radius);
+        size_t inside_count = 0;
+        for (Entity *e: candidates)
+        {
+            if (LengthSq(PositionOf(e) - center) <= radius_sq)
+            {
+                inside_count += 1;
+            }
+        }
+
+        if ((inside_count >= k) || covers_world)
         {
-            iter->entity += 1;
-            if (iter->entity >= end)
+            result.count = 0;
+            for (Entity *e: candidates)
             {
-                iter->entity = nullptr;
+                uint32_t dist_sq = LengthSq(PositionOf(e) - center);
+                if ((result.count == k) && (dist_sq >= result_dist_sq[k - 1]))
+                {
+                    continue;
+                }
+
+                size_t at = Min((int)result.count, (int)k - 1);
+                while ((at > 0) && (result_dist_sq[at - 1] > dist_sq))
+                {
+                    result.data[at] = result.data[at - 1];
+                    result_dist_sq[at] = result_dist_sq[at - 1];
+                    at -= 1;
+                }
+
+                result.data[at] = e;
+                result_dist_sq[at] = dist_sq;
+                if (result.count < k)
+                {
+                    result.count += 1;
+                }
             }
+            break;
+        }
+    }
+
+    return result;
+}
+
+// NOTE: Finds the nearest entity within radius whose faction is hostile to the given one.
+// Chunks that don't hold any members of a hostile faction are skipped without looking at
+// their tiles, so this costs about as much as there are enemies nearby.
+static inline Entity *
+FindNearestHostile(V2i center, FactionKind faction, int radius)
+{
+    bool hostile_factions[Faction_COUNT] = {};
+    bool any_hostile_faction = false;
+    for (int other = 0; other < Faction_COUNT; ++other)
+    {
+        hostile_factions[other] = FactionIsHostileTo(faction, (FactionKind)other);
+        any_hostile_faction |= hostile_factions[other];
+    }
+
+    if (!any_hostile_faction)
+    {
+        return nullptr;
+    }
+
+    Rect2i rect = MakeRect2iMinMax(center - MakeV2i(radius, radius), center + MakeV2i(radius + 1, radius + 1));
+    rect = Intersect(rect, 0, 0, entity_manager->world_w, entity_manager->world_h);
+    if ((rect.min.x >= rect.max.x) || (rect.min.y >= rect.max.y))
+    {
+        return nullptr;
+    }
+
+    int chunk_min_x = rect.min.x >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_min_y = rect.min.y >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_x = (rect.max.x - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+    int chunk_max_y = (rect.max.y - 1) >> ENTITY_CHUNK_SIZE_LOG2;
+
+    Entity *result = nullptr;
+    int32_t best_dist_sq = radius*radius + 1;
+
+    for (int chunk_y = chunk_min_y; chunk_y <= chunk_max_y; chunk_y += 1)
+    for (int chunk_x = chunk_min_x; chunk_x <= chunk_max_x; chunk_x += 1)
+    {
+        EntityChunk *chunk = entity_manager->chunks[chunk_y*entity_manager->chunk_count_x + chunk_x];
+        if (!chunk)
+        {
+            continue;
+        }
+
+        bool has_hostiles = false;
+        for (int other = 0; other < Faction_COUNT; ++other)
+        {
+            has_hostiles |= (hostile_factions[other] && chunk->faction_occupancy[other] > 0);
         }
 
-        if (HasProperties(iter->entity, iter->filter))
+        if (!has_hostiles)
         {
-            break;
+            continue;
         }
-    }
-}
-
-static inline EntityArray
-GetEntitiesAt(V2i p, EntityPropertySet filter = {})
-{
-    EntityArray result = {};
-    if (IsInWorld(p))
-    {
-        Entity *list = entity_manager->entity_grid[p.x][p.y];
 
-        size_t count = 0;
-        for (Entity *e = list; e; e = e->next_on_tile)
+        Rect2i chunk_rect = Intersect(rect,
+                                      chunk_x << ENTITY_CHUNK_SIZE_LOG2,
+                                      chunk_y << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_x + 1) << ENTITY_CHUNK_SIZE_LOG2,
+                                      (chunk_y + 1) << ENTITY_CHUNK_SIZE_LOG2);
+        for (int y = chunk_rect.min.y; y < chunk_rect.max.y; y += 1)
+        for (int x = chunk_rect.min.x; x < chunk_rect.max.x; x += 1)
         {
-            if (HasProperties(e, filter))
+            V2i p = MakeV2i(x, y);
+            int32_t dist_sq = LengthSq(p - center);
+            if (dist_sq >= best_dist_sq)
             {
-                count += 1;
+                continue;
             }
-        }
-
-        result = PushArrayContainer<Entity *>(platform->GetTempArena(), count);
 
-        for (Entity *e = list; e; e = e->next_on_tile)
-        {
-            if (HasProperties(e, filter))
+            for (Entity *e = *GetChunkTile(chunk, p); e; e = e->next_on_tile)
             {
-                Push(&result, e);
+                if (hostile_factions[e->faction])
+                {
+                    best_dist_sq = dist_sq;
+                    result = e;
+                    break;
+                }
             }
         }
     }
-    return result;
-}
 
-static inline bool
-TileBlocked(V2i p)
-{
-    EntityArray arr = GetEntitiesAt(p, MakeSet(EntityProperty_BlockMovement));
-    return arr.count > 0;
+    return result;
 }
 
 static inline Entity *
 FindClosestEntity(V2i p, EntityPropertyKind required_property, Entity *filter = nullptr)
 {
-    uint32_t best_dist = UINT32_MAX;
-    Entity *result = nullptr;
-    for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
+    EntityPropertySet property_filter = {};
+    if (required_property != EntityProperty_None)
     {
-        Entity *e = iter.entity;
-
-        if (e == filter)
-        {
-            continue;
-        }
+        property_filter = MakeSet(required_property);
+    }
 
-        if (required_property != EntityProperty_None &&
-            !HasProperty(e, required_property))
-        {
-            continue;
-        }
+    Arena *arena = platform->GetTempArena();
+    ScopedMemory temp(arena);
 
-        V2i delta = p - e->p;
-        uint32_t dist = LengthSq(delta);
-        if (best_dist > dist)
+    Entity *result = nullptr;
+    for (Entity *e: QueryKNearest(arena, p, filter ? 2 : 1, property_filter))
+    {
+        if (e != filter)
         {
-            best_dist = dist;
             result = e;
+            break;
         }
     }
     return result;
@@ -607,8 +1989,34 @@ BasicDamage(EntityHandle aggressor, int32_t amount)
     return result;
 }
 
-static inline bool
+static inline void
+QueueEntityEvent(EntityEventKind kind, Entity *subject, Entity *other = nullptr, int32_t amount = 0)
+{
+    if (entity_manager->event_count >= entity_manager->event_capacity)
+    {
+        uint32_t new_capacity = (entity_manager->event_capacity ? 2*entity_manager->event_capacity : 256);
+        EntityEvent *new_events = PushArrayNoClear(&entity_manager->event_arena, new_capacity, EntityEvent);
+        CopyArray(entity_manager->event_count, entity_manager->events, new_events);
+        entity_manager->event_capacity = new_capacity;
+        entity_manager->events = new_events;
+    }
+
+    EntityEvent *event = &entity_manager->events[entity_manager->event_count++];
+    event->kind = kind;
+    event->subject = HandleFromEntity(subject);
+    event->other = (other ? HandleFromEntity(other) : NullEntityHandle());
+    event->amount = amount;
+}
+
+static inline void
 TakeDamage(Entity *e, const DamageDescriptor &desc)
+{
+    Entity *aggressor = EntityFromHandle(desc.aggressor);
+    QueueEntityEvent(EntityEvent_Damage, e, aggressor, desc.amount);
+}
+
+static inline bool
+ApplyDamage(Entity *e, const DamageDescriptor &desc)
 {
     if (!HasProperty(e, EntityProperty_Dying))
     {
@@ -623,6 +2031,11 @@ TakeDamage(Entity *e, const DamageDescriptor &desc)
         {
             AddToListUnique(&e->forced_hostile_entities, desc.aggressor);
         }
+        if (HasProperty(e, EntityProperty_InWorld))
+        {
+            MakeNoise(PositionOf(e), SIM_NOISE_RADIUS);
+        }
+        WakeEntity(e);
         return true;
     }
     return false;
@@ -635,10 +2048,17 @@ enum
     Raycast_TestSight = 0x2,
 };
 
-static inline EntityArray
+struct RaycastResult
+{
+    bool hit;
+    V2i hit_p;
+    EntityArray entities; // NOTE: The blocking entities at hit_p, empty if it was the terrain that blocked
+};
+
+static inline RaycastResult
 Raycast(V2i start, V2i end, RaycastFlags flags = Raycast_TestMovement)
 {
-    EntityArray result = {};
+    RaycastResult result = {};
 
     int x0 = start.x;
     int y0 = start.y;
@@ -655,21 +2075,24 @@ Raycast(V2i start, V2i end, RaycastFlags flags = Raycast_TestMovement)
     int x = x0;
     int y = y0;
 
+    EntityPropertySet filter = {};
+    if (flags & Raycast_TestMovement) filter |= EntityProperty_BlockMovement;
+    if (flags & Raycast_TestSight   ) filter |= EntityProperty_BlockSight;
+
     for (;;)
     {
         V2i p = MakeV2i(x, y);
 
-        if (!AreEqual(p, start))
+        // NOTE: The bitplanes tell us whether anything on the tile blocks, only go look at the
+        // entities on a hit.
+        bool blocked = (((flags & Raycast_TestMovement) && GetTileBit(&entity_manager->block_movement, p)) ||
+                        ((flags & Raycast_TestSight) && GetTileBit(&entity_manager->block_sight, p)));
+        if (blocked && !AreEqual(p, start))
         {
-            EntityPropertySet filter = {};
-            if (flags & Raycast_TestMovement) filter |= EntityProperty_BlockMovement;
-            if (flags & Raycast_TestSight   ) filter |= EntityProperty_BlockSight;
-            EntityArray on_tile = GetEntitiesAt(p, filter);
-            if (on_tile.count)
-            {
-                result = on_tile;
-                break;
-            }
+            result.hit = true;
+            result.hit_p = p;
+            result.entities = GetEntitiesAt(p, filter);
+            break;
         }
 
         if (x == x1 && y == y1)
@@ -695,111 +2118,259 @@ Raycast(V2i start, V2i end, RaycastFlags flags = Raycast_TestMovement)
     return result;
 }
 
-struct PathNode
+static inline bool
+TileBlocksPathing(V2i p)
 {
-    PathNode *next_in_hash;
-    PathNode *next, *prev;
-    float cost;
-    V2i p;
-};
+    return !IsInWorld(p) || GetTileBit(&entity_manager->block_pathing, p);
+}
 
-struct PathfindingState
+static const V2i dijkstra_moves[] =
 {
-    PathNode *node_hash[1024];
+    MakeV2i(-1, -1), MakeV2i( 1, -1), MakeV2i(-1, 1), MakeV2i( 1,  1),
+    MakeV2i(-1,  0), MakeV2i( 1,  0), MakeV2i( 0, 1), MakeV2i( 0, -1),
 };
 
-static inline Path
-FindPath(Arena *arena, V2i start, V2i target)
+static inline int32_t
+GetDijkstraStepCost(V2i move)
 {
-    Arena *temp_arena = platform->GetTempArena();
-    ScopedMemory temp(temp_arena);
-
-    //
-    // NOTE: This is Dijkstra, for now. A* is annoying, if this is fast enough let's keep things simple.
-    //
-
-    Path result = {};
-    PathfindingState *state = PushStruct(temp_arena, PathfindingState);
+    return (move.x && move.y) ? 3 : 2;
+}
 
-    static const V2i possible_moves[] =
+static inline int32_t
+GetDijkstraDistance(DijkstraMap *map, V2i p)
+{
+    int32_t result = DIJKSTRA_UNREACHABLE;
+    if (IsInWorld(p))
     {
-        MakeV2i(-1, -1), MakeV2i( 1, -1), MakeV2i(-1, 1), MakeV2i( 1,  1),
-        MakeV2i(-1,  0), MakeV2i( 1,  0), MakeV2i( 0, 1), MakeV2i( 0, -1),
-    };
-
-    PathNode *first = PushStruct(temp_arena, PathNode);
-    first->p = start;
+        int32_t stored = map->distances[p.y*entity_manager->world_w + p.x];
+        if (stored != DIJKSTRA_UNREACHABLE)
+        {
+            result = stored + map->bias;
+        }
+    }
+    return result;
+}
 
-    PathNode *queue = first;
+// NOTE: Floods out from the target, lowering the distance of every tile it can improve on.
+// Step costs are 2 or 3, so a tentative distance is never more than 3 past the one being
+// expanded, and 4 buckets indexed by distance % 4 make a perfectly good priority queue.
+static inline void
+FloodDijkstraMap(DijkstraMap *map)
+{
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
 
-    size_t node_count = 0;
+    int w = entity_manager->world_w;
+    int h = entity_manager->world_h;
+    size_t tile_count = (size_t)w*h;
 
-    PathNode *target_node = nullptr;
-    while (queue)
+    // NOTE: A tile only goes into the bucket for a given distance once, so no bucket can hold
+    // more than every tile.
+    uint32_t *buckets[4];
+    size_t bucket_counts[4] = {};
+    for (size_t i = 0; i < ArrayCount(buckets); ++i)
     {
-        PathNode *top_node = queue;
-        queue = queue->next;
+        buckets[i] = PushArrayNoClear(temp_arena, tile_count, uint32_t);
+    }
 
-        if (AreEqual(top_node->p, target))
-        {
-            target_node = top_node;
-            break;
-        }
+    int32_t target_distance = 0;
+    map->distances[map->target_p.y*w + map->target_p.x] = target_distance - map->bias;
+    buckets[0][bucket_counts[0]++] = (uint32_t)(map->target_p.y*w + map->target_p.x);
 
-        for (size_t i = 0; i < ArrayCount(possible_moves); ++i)
+    size_t pending_count = 1;
+    for (int32_t distance = target_distance; pending_count; ++distance)
+    {
+        uint32_t *bucket = buckets[distance % 4];
+        size_t *bucket_count = &bucket_counts[distance % 4];
+        for (size_t i = 0; i < *bucket_count; ++i)
         {
-            V2i p = top_node->p + possible_moves[i];
-
-            uint64_t slot = HashCoordinate(p) % ArrayCount(state->node_hash);
-            PathNode *on_tile = state->node_hash[slot];
-            for (; on_tile && !AreEqual(on_tile->p, p); on_tile = on_tile->next_in_hash);
-            if (on_tile)
+            uint32_t index = bucket[i];
+            if (map->distances[index] + map->bias != distance)
             {
+                // NOTE: Stale, this tile got a shorter distance after it went into the bucket
                 continue;
             }
 
-            if (!TileBlocked(p) || AreEqual(p, target))
+            V2i p = MakeV2i((int)(index % w), (int)(index / w));
+            for (size_t move_index = 0; move_index < ArrayCount(dijkstra_moves); ++move_index)
             {
-                PathNode *node = PushStruct(temp_arena, PathNode);
-                node->prev = top_node;
-                node->p = p;
-                node->cost = top_node->cost + Length(possible_moves[i]); /* + DiagonalDistance(p, target); */
+                V2i move = dijkstra_moves[move_index];
+                V2i next_p = p + move;
+                if (TileBlocksPathing(next_p))
+                {
+                    continue;
+                }
 
-                PathNode **insert_at = &queue;
-                for (; *insert_at; insert_at = &(*insert_at)->next)
+                int32_t next_distance = distance + GetDijkstraStepCost(move);
+                uint32_t next_index = (uint32_t)(next_p.y*w + next_p.x);
+                int32_t stored = map->distances[next_index];
+                if ((stored == DIJKSTRA_UNREACHABLE) || (next_distance < stored + map->bias))
                 {
-                    PathNode *insert = *insert_at;
-                    if (insert->cost > node->cost)
-                    {
-                        break;
-                    }
+                    map->distances[next_index] = next_distance - map->bias;
+                    size_t next_bucket = (size_t)next_distance % 4;
+                    buckets[next_bucket][bucket_counts[next_bucket]++] = next_index;
+                    pending_count += 1;
                 }
+            }
+        }
+        pending_count -= *bucket_count;
+        *bucket_count = 0;
+    }
+}
+
+static inline void
+RebuildDijkstraMap(DijkstraMap *map)
+{
+    ProfileScope();
+
+    size_t tile_count = (size_t)entity_manager->world_w*entity_manager->world_h;
+    for (size_t i = 0; i < tile_count; ++i)
+    {
+        map->distances[i] = DIJKSTRA_UNREACHABLE;
+    }
+    map->bias = 0;
+
+    FloodDijkstraMap(map);
+}
+
+// NOTE: When the target takes one step at cost c, no tile can end up more than c further
+// from it than before, so bumping the bias by c gives a valid upper bound for every tile at
+// once. Flooding from the new target position then only has to touch the tiles that got
+// closer, the rest are already right.
+static inline void
+UpdateDijkstraMap(DijkstraMap *map, V2i new_target_p)
+{
+    ProfileScope();
+
+    V2i move = new_target_p - map->target_p;
+    map->bias += GetDijkstraStepCost(move);
+    map->target_p = new_target_p;
+
+    FloodDijkstraMap(map);
+}
+
+// NOTE: Whether getting the target's Dijkstra map would mean throwing out one that's still in
+// use, as in used this schedule round or the one before. turn_index goes up with every action,
+// so it can't tell. With more targets being chased than there are maps they'd keep evicting
+// each other and rebuilding whole maps for every step, so the chasers are better off following
+// a cached path instead. Counting the round before too keeps the targets that had maps from
+// losing them to whoever happens to act first in the next round.
+static inline bool
+DijkstraMapWouldThrash(Entity *target)
+{
+    EntityHandle handle = HandleFromEntity(target);
+    for (size_t i = 0; i < MAX_DIJKSTRA_MAPS; ++i)
+    {
+        DijkstraMap *map = &entity_manager->dijkstra_maps[i];
+        if (!map->distances ||
+            (map->target == handle) ||
+            (map->last_used_round + 1 < entity_manager->schedule_round))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: Returns the Dijkstra map leading to the target, building or updating it if the
+// target moved or the pathing changed since it was last used. Maps are cached per target,
+// so everybody chasing the same thing shares one.
+static inline DijkstraMap *
+GetDijkstraMap(Entity *target)
+{
+    EntityHandle handle = HandleFromEntity(target);
+    V2i target_p = PositionOf(target);
+
+    DijkstraMap *result = nullptr;
+    DijkstraMap *least_recently_used = &entity_manager->dijkstra_maps[0];
+    for (size_t i = 0; i < MAX_DIJKSTRA_MAPS; ++i)
+    {
+        DijkstraMap *map = &entity_manager->dijkstra_maps[i];
+        if (map->distances && (map->target == handle))
+        {
+            result = map;
+            break;
+        }
+        if (!map->distances || (map->last_used_turn < least_recently_used->last_used_turn))
+        {
+            least_recently_used = map;
+        }
+    }
 
-                node->next = *insert_at;
-                *insert_at = node;
+    bool rebuild = false;
+    if (!result)
+    {
+        result = least_recently_used;
+        if (!result->distances)
+        {
+            size_t tile_count = (size_t)entity_manager->world_w*entity_manager->world_h;
+            result->distances = PushArrayNoClear(&entity_manager->arena, tile_count, int32_t);
+        }
+        result->target = handle;
+        rebuild = true;
+    }
 
-                node->next_in_hash = state->node_hash[slot];
-                state->node_hash[slot] = node;
+    result->last_used_turn = entity_manager->turn_index;
+    result->last_used_round = entity_manager->schedule_round;
 
-                node_count += 1;
+    V2i delta = target_p - result->target_p;
+    if (rebuild ||
+        (result->pathing_version != entity_manager->pathing_version) ||
+        (Abs(delta.x) > 1) || (Abs(delta.y) > 1) ||
+        TileBlocksPathing(target_p))
+    {
+        result->target_p = target_p;
+        result->pathing_version = entity_manager->pathing_version;
+        if (!TileBlocksPathing(target_p))
+        {
+            RebuildDijkstraMap(result);
+        }
+        else
+        {
+            // NOTE: Whatever's standing in a blocked spot can't be reached, nothing to build
+            size_t tile_count = (size_t)entity_manager->world_w*entity_manager->world_h;
+            for (size_t i = 0; i < tile_count; ++i)
+            {
+                result->distances[i] = DIJKSTRA_UNREACHABLE;
             }
         }
     }
+    else if (!AreEqual(delta, MakeV2i(0, 0)))
+    {
+        UpdateDijkstraMap(result, target_p);
+    }
+
+    return result;
+}
+
+// NOTE: Picks the open neighbouring tile that goes furthest downhill (or uphill, if fleeing).
+// Returns false if there's no move that improves on standing still.
+static inline bool
+StepOnDijkstraMap(DijkstraMap *map, V2i from, V2i *step, bool flee = false)
+{
+    int32_t from_distance = GetDijkstraDistance(map, from);
+    if (from_distance == DIJKSTRA_UNREACHABLE)
+    {
+        return false;
+    }
 
-    if (target_node)
+    bool result = false;
+    int32_t best_distance = from_distance;
+    for (size_t move_index = 0; move_index < ArrayCount(dijkstra_moves); ++move_index)
     {
-        uint32_t path_length = 0;
-        for (PathNode *node = target_node; node && node != first; node = node->prev)
+        V2i p = from + dijkstra_moves[move_index];
+        int32_t distance = GetDijkstraDistance(map, p);
+        if ((distance == DIJKSTRA_UNREACHABLE) || TileBlocked(p))
         {
-            path_length += 1;
+            continue;
         }
 
-        result.length = path_length;
-        result.positions = PushArrayNoClear(arena, result.length, V2i);
-        size_t i = path_length - 1;
-        for (PathNode *node = target_node; node && node != first; node = node->prev)
+        bool better = (flee ? (distance > best_distance) : (distance < best_distance));
+        if (better)
         {
-            result.positions[i--] = node->p;
+            best_distance = distance;
+            *step = p;
+            result = true;
         }
     }
 
@@ -820,17 +2391,17 @@ TryOpen(Entity *e, Entity *other)
     }
     else
     {
-        ForSll (item, other->inventory.first)
+        for (EntityListIter iter = IterateList(&other->inventory); IsValid(iter); Next(&iter))
         {
-            if (item->handle == e->required_key)
+            if (HandleFromEntity(iter.entity) == e->required_key)
             {
-                Entity *key = EntityFromHandle(item->handle);
+                Entity *key = iter.entity;
                 if (key->uses > 0)
                 {
                     key->uses -= 1;
                     if (key->uses <= 0)
                     {
-                        KillEntity(key);
+                        QueueEntityEvent(EntityEvent_Death, key);
                     }
                 }
                 e->locked = false;
@@ -872,27 +2443,150 @@ ProcessTrigger(Entity *e, Entity *other)
     }
 }
 
+static inline void
+ApplyEntityEvent(const EntityEvent &event)
+{
+    Entity *subject = EntityFromHandle(event.subject);
+    if (!subject)
+    {
+        return;
+    }
+
+    Entity *other = EntityFromHandle(event.other);
+
+    switch (event.kind)
+    {
+        case EntityEvent_Damage:
+        {
+            ApplyDamage(subject, BasicDamage(event.other, event.amount));
+        } break;
+
+        case EntityEvent_Trigger:
+        {
+            if (other)
+            {
+                ProcessTrigger(subject, other);
+            }
+        } break;
+
+        case EntityEvent_PickUp:
+        {
+            if (other)
+            {
+                AddToInventory(other, subject);
+            }
+        } break;
+
+        case EntityEvent_Death:
+        {
+            KillEntity(subject);
+        } break;
+
+        default: break;
+    }
+}
+
+// NOTE: Applies the queued events one kind at a time. Resolving events can queue up more of
+// them (a key breaking when a door gets opened), those get picked up by another round.
+static inline void
+ResolveEntityEvents(void)
+{
+    ProfileScope();
+
+    uint32_t resolved_count = 0;
+    while (resolved_count < entity_manager->event_count)
+    {
+        uint32_t end = entity_manager->event_count;
+        for (int kind = EntityEvent_None + 1; kind < EntityEvent_COUNT; ++kind)
+        {
+            for (uint32_t i = resolved_count; i < end; ++i)
+            {
+                // NOTE: Copied out, applying an event can queue more and move the array
+                EntityEvent event = entity_manager->events[i];
+                if (event.kind == kind)
+                {
+                    ApplyEntityEvent(event);
+                }
+            }
+        }
+        resolved_count = end;
+    }
+
+    entity_manager->event_count = 0;
+    entity_manager->event_capacity = 0;
+    entity_manager->events = nullptr;
+    Clear(&entity_manager->event_arena);
+}
+
+// NOTE: Moves the player one step, or bumps into whatever is in the way. Returns whether
+// that used up the player's turn.
 static inline bool
-PlayerAct(void)
+PlayerTryMove(V2i move)
 {
     Entity *player = entity_manager->player;
-    if (!player)
+    V2i move_p = PositionOf(player) + move;
+
+    entity_manager->looking_at_container = nullptr;
+
+    // NOTE: Bumping into something sets off its trigger before deciding whether the way is
+    // blocked, so a door opens and lets the player through in the same turn. The triggers get
+    // resolved here and now for that, outside of the loop over the tile.
+    bool any_triggers = false;
+    for (Entity *e: GetEntitiesAt(move_p))
+    {
+        if (e->contact_trigger)
+        {
+            QueueEntityEvent(EntityEvent_Trigger, e, player);
+            any_triggers = true;
+        }
+    }
+    if (any_triggers)
+    {
+        ResolveEntityEvents();
+    }
+
+    bool blocked = false;
+    for (Entity *e: GetEntitiesAt(move_p))
+    {
+        if (HasProperty(e, EntityProperty_BlockMovement))
+        {
+            if (HasProperty(e, EntityProperty_Invulnerable))
+            {
+                // blocked with no recourse
+                blocked = true;
+            }
+            else
+            {
+                TakeDamage(e, BasicDamage(HandleFromEntity(player), 1));
+                return true;
+            }
+        }
+    }
+
+    if (!blocked)
     {
+        MoveEntity(player, move_p);
         return true;
     }
 
-    player->energy += player->speed;
-    if (player->energy < 100)
+    return false;
+}
+
+static inline bool
+PlayerAct(void)
+{
+    Entity *player = entity_manager->player;
+    if (!player)
     {
-        return false;
+        return true;
     }
 
     bool there_is_stuff_on_the_ground = false;
-    for (Entity *e = GetEntitesOnTile(player->p);
+    for (Entity *e = GetEntitesOnTile(PositionOf(player));
          e;
          e = e->next_on_tile)
     {
-        if (e->handle != player->handle)
+        if (HandleFromEntity(e) != HandleFromEntity(player))
         {
             there_is_stuff_on_the_ground = true;
             break;
@@ -920,11 +2614,11 @@ PlayerAct(void)
     if (entity_manager->looking_at_ground)
     {
         int count = 0;
-        for (Entity *e = GetEntitesOnTile(player->p);
+        for (Entity *e = GetEntitesOnTile(PositionOf(player));
              e;
              e = e->next_on_tile)
         {
-            if (e->handle == player->handle)
+            if (HandleFromEntity(e) == HandleFromEntity(player))
             {
                 continue;
             }
@@ -948,18 +2642,18 @@ PlayerAct(void)
             if (Triggered(input->east))
             {
                 size_t i = 0;
-                for (Entity *e = GetEntitesOnTile(player->p);
+                for (Entity *e = GetEntitesOnTile(PositionOf(player));
                      e;
                      e = e->next_on_tile)
                 {
-                    if (e->handle == player->handle)
+                    if (HandleFromEntity(e) == HandleFromEntity(player))
                     {
                         continue;
                     }
 
                     if (i == entity_manager->container_selection_index)
                     {
-                        AddToInventory(player, e);
+                        QueueEntityEvent(EntityEvent_PickUp, e, player);
                         break;
                     }
                     i += 1;
@@ -972,7 +2666,8 @@ PlayerAct(void)
     {
         if (entity_manager->looking_at_container)
         {
-            if (!entity_manager->looking_at_container->inventory.first)
+            CleanStaleReferences(&entity_manager->looking_at_container->inventory);
+            if (!entity_manager->looking_at_container->inventory.count)
             {
                 entity_manager->looking_at_container = nullptr;
             }
@@ -981,27 +2676,27 @@ PlayerAct(void)
         if (entity_manager->looking_at_container)
         {
             Entity *container = entity_manager->looking_at_container;
-            EntityArray items = Pull(&container->inventory);
+            EntityList *items = &container->inventory;
 
             if (Triggered(input->north)) entity_manager->container_selection_index -= 1;
             if (Triggered(input->south)) entity_manager->container_selection_index += 1;
             if (entity_manager->container_selection_index < 0)
             {
-                entity_manager->container_selection_index += (int)items.count;
+                entity_manager->container_selection_index += (int)items->count;
             }
-            if (entity_manager->container_selection_index >= (int)items.count)
+            if (entity_manager->container_selection_index >= (int)items->count)
             {
-                entity_manager->container_selection_index -= (int)items.count;
+                entity_manager->container_selection_index -= (int)items->count;
             }
 
             if (Triggered(input->east))
             {
-                Entity *taken_item = RemoveOrdered(&items, entity_manager->container_selection_index);
-                AddToInventory(player, taken_item);
-                entity_manager->container_selection_index = Clamp(entity_manager->container_selection_index, 0, (int)items.count - 1);
+                EntityHandle taken_item = RemoveFromListOrdered(items, entity_manager->container_selection_index);
+                RemoveFromStackIndex(&container->inventory_stack_index, EntityFromHandle(taken_item));
+                QueueEntityEvent(EntityEvent_PickUp, EntityFromHandle(taken_item), player);
+                entity_manager->container_selection_index = Clamp(entity_manager->container_selection_index, 0, (int)items->count - 1);
             }
 
-            Place(&container->inventory, items);
             return false;
         }
     }
@@ -1019,36 +2714,8 @@ PlayerAct(void)
     bool result = false;
     if (!AreEqual(move, MakeV2i(0, 0)))
     {
-        V2i move_p = player->p + move;
-
-        entity_manager->looking_at_container = nullptr;
-        
-        bool blocked = false;
-        for (Entity *e: GetEntitiesAt(move_p))
-        {
-            if (e->contact_trigger)
-            {
-                ProcessTrigger(e, player);
-            }
-
-            if (HasProperty(e, EntityProperty_BlockMovement))
-            {
-                if (HasProperty(e, EntityProperty_Invulnerable))
-                {
-                    // blocked with no recourse
-                    blocked = true;
-                }
-                else
-                {
-                    TakeDamage(e, BasicDamage(player->handle, 1));
-                    return true;
-                }
-            }
-        }
-
-        if (!blocked)
+        if (PlayerTryMove(move))
         {
-            MoveEntity(player, move_p);
             return true;
         }
     }
@@ -1078,7 +2745,7 @@ static inline void
 MarkAsSeen(Entity *e)
 {
     e->seen_by_player = true;
-    e->seen_p = e->p;
+    e->seen_p = PositionOf(e);
 }
 
 static inline void
@@ -1090,22 +2757,22 @@ CalculateVisibilityMassRay(VisibilityGrid *grid, Entity *e, float radius)
     for (int x = 0; x <= w; x += 1)
     {
         V2i p = MakeV2i(x + grid->bounds.min.x, y + grid->bounds.min.y);
-        if (AreEqual(p, e->p))
+        if (AreEqual(p, PositionOf(e)))
         {
             grid->tiles[y*w + x] = true;
         }
-        else if (Length(e->p - p) <= radius)
+        else if (Length(PositionOf(e) - p) <= radius)
         {
-            EntityArray hit_entities = Raycast(e->p, p, Raycast_TestSight);
-            if (hit_entities.count)
+            RaycastResult hit = Raycast(PositionOf(e), p, Raycast_TestSight);
+            if (hit.hit)
             {
-                for (Entity *seen: hit_entities)
+                if (IsInRect(grid->bounds, hit.hit_p))
+                {
+                    grid->tiles[y*w + x] = true;
+                    SetSeenByPlayer(game_state->gen_tiles, hit.hit_p, true);
+                }
+                for (Entity *seen: hit.entities)
                 {
-                    if (IsInRect(grid->bounds, seen->p))
-                    {
-                        grid->tiles[y*w + x] = true;
-                        SetSeenByPlayer(game_state->gen_tiles, seen->p, true);
-                    }
                     MarkAsSeen(seen);
                 }
             }
@@ -1199,16 +2866,16 @@ CalculateVisibilityRecursiveShadowcastInternal(VisibilityGrid *grid, bool is_pla
                              ((float)col <= (float)row*end_slope));
         V2i p = origin + TransformForQuadrant(quadrant, MakeV2i(col, row));
         V2i p_rel = MakeV2i(col, row);
-        for (Entity *e: GetEntitiesAt(p))
+        for (Entity *e = GetEntitesOnTile(p); e; e = e->next_on_tile)
         {
             MarkAsSeen(e);
-            if (HasProperty(e, EntityProperty_BlockSight))
-            {
-                SetVisible(grid, p);
-                if (is_player) SetSeenByPlayer(game_state->gen_tiles, p, true);
+        }
+        if (TileBlocksSight(p))
+        {
+            SetVisible(grid, p);
+            if (is_player) SetSeenByPlayer(game_state->gen_tiles, p, true);
 
-                is_wall = true;
-            }
+            is_wall = true;
         }
         if (is_symmetric)
         {
@@ -1240,19 +2907,19 @@ CalculateVisibilityRecursiveShadowcast(VisibilityGrid *grid, Entity *e)
     bool is_player = (entity_manager->player && (e == entity_manager->player));
     for (int i = 0; i < 4; i += 1)
     {
-        CalculateVisibilityRecursiveShadowcastInternal(grid, is_player, i, e->p, 1, -1, 1);
+        CalculateVisibilityRecursiveShadowcastInternal(grid, is_player, i, PositionOf(e), 1, -1, 1);
     }
 
-    SetVisible(grid, e->p);
+    SetVisible(grid, PositionOf(e));
     MarkAsSeen(e);
-    if (is_player) SetSeenByPlayer(game_state->gen_tiles, e->p, true);
+    if (is_player) SetSeenByPlayer(game_state->gen_tiles, PositionOf(e), true);
 }
 
 static inline VisibilityGrid *
 PushAndCalculateVisibility(Arena *arena, Entity *e)
 {
     int radius = RoundUp(e->view_radius);
-    Rect2i bounds = MakeRect2iCenterHalfDim(e->p, MakeV2i(radius));
+    Rect2i bounds = MakeRect2iCenterHalfDim(PositionOf(e), MakeV2i(radius));
 
     VisibilityGrid *result = PushVisibilityGrid(arena, bounds);
     CalculateVisibilityRecursiveShadowcast(result, e);
@@ -1268,7 +2935,7 @@ IsVisibleTo(Entity *e, V2i p)
         return false;
     }
 
-    if (Length(p - e->p) > e->view_radius)
+    if (Length(p - PositionOf(e)) > e->view_radius)
     {
         return false;
     }
@@ -1276,83 +2943,234 @@ IsVisibleTo(Entity *e, V2i p)
     return IsVisible(e->visibility_grid, p);
 }
 
-static inline bool
-EntityAct(Entity *e)
+enum AiIntentKind
 {
+    AiIntent_None,
+    AiIntent_Attack,
+    AiIntent_Chase,
+};
+
+struct AiIntent
+{
+    AiIntentKind kind;
+    EntityHandle target;
+};
+
+// NOTE: Works out what the entity wants to do without touching the world, so it's safe to
+// run for many entities at once on the job threads. Anything that can go stale by the time
+// the intent gets applied is checked again in ApplyEntityIntent.
+static inline AiIntent
+DecideEntityAct(Entity *e)
+{
+    AiIntent result = {};
+
     if (e->ai != Ai_None)
     {
-        e->energy += e->speed;
-        while (e->energy > 100)
+        // NOTE: Anything further out than the engagement radius gets ignored below anyway
+        int32_t best_dist_sq = INT32_MAX;
+        Entity *target = FindNearestHostile(PositionOf(e), e->faction, AI_ENGAGEMENT_RADIUS);
+        if (target)
         {
-            e->energy -= 100;
+            best_dist_sq = LengthSq(PositionOf(e) - PositionOf(target));
+        }
 
-            int32_t best_dist_sq = INT32_MAX;
-            Entity *target = nullptr;
-            for (EntityIter iter_other = IterateAllEntities(); IsValid(iter_other); Next(&iter_other))
+        for (EntityListIter iter = IterateList(&e->forced_hostile_entities); IsValid(iter); Next(&iter))
+        {
+            Entity *other = iter.entity;
+            V2i delta = PositionOf(e) - PositionOf(other);
+            int32_t dist_sq = LengthSq(delta);
+            if (dist_sq < best_dist_sq)
             {
-                Entity *other = iter_other.entity;
+                best_dist_sq = dist_sq;
+                target = other;
+            }
+        }
 
-                if (FactionIsHostileTo(e->faction, other->faction))
+        if (target)
+        {
+            V2i delta = PositionOf(e) - PositionOf(target);
+            int32_t dist_sq = LengthSq(delta);
+            if (dist_sq < AI_ENGAGEMENT_RADIUS*AI_ENGAGEMENT_RADIUS)
+            {
+                for (Entity *seen: Raycast(PositionOf(e), PositionOf(target), Raycast_TestSight).entities)
                 {
-                    V2i delta = e->p - other->p;
-                    int32_t dist_sq = LengthSq(delta);
-                    if (dist_sq < best_dist_sq)
+                    if (seen == target)
                     {
-                        best_dist_sq = dist_sq;
-                        target = other;
+                        if ((Abs(delta.x) <= 1) &&
+                            (Abs(delta.y) <= 1))
+                        {
+                            result.kind = AiIntent_Attack;
+                        }
+                        else
+                        {
+                            result.kind = AiIntent_Chase;
+                        }
+                        result.target = HandleFromEntity(target);
+
+                        break;
                     }
                 }
             }
+        }
+    }
+
+    return result;
+}
+
+// NOTE: Intents are applied one at a time in actor order, so when two entities went for
+// the same thing the first one wins and the second gets whatever the world looks like
+// after. Chasing steps on the Dijkstra map against the current blocking, which is what
+// keeps two monsters from ending up on the same tile.
+static inline bool
+ApplyEntityIntent(Entity *e, AiIntent intent)
+{
+    Entity *target = EntityFromHandle(intent.target);
+    if (!target)
+    {
+        return false;
+    }
+
+    switch (intent.kind)
+    {
+        case AiIntent_Attack:
+        {
+            V2i delta = PositionOf(e) - PositionOf(target);
+            if ((Abs(delta.x) <= 1) &&
+                (Abs(delta.y) <= 1))
+            {
+                TakeDamage(target, BasicDamage(HandleFromEntity(e), 1));
+                return true;
+            }
+        } break;
 
-            for (Entity *other: Linearize(&e->forced_hostile_entities))
+        case AiIntent_Chase:
+        {
+            V2i step;
+            bool stepped = false;
+            if (DijkstraMapWouldThrash(target))
             {
-                V2i delta = e->p - other->p;
-                int32_t dist_sq = LengthSq(delta);
-                if (dist_sq < best_dist_sq)
-                {
-                    best_dist_sq = dist_sq;
-                    target = other;
-                }
+                stepped = GetCachedPathStep(e, PositionOf(target), &step);
+            }
+            else
+            {
+                DijkstraMap *map = GetDijkstraMap(target);
+                stepped = StepOnDijkstraMap(map, PositionOf(e), &step);
             }
 
-            if (target)
+            if (stepped)
             {
-                V2i delta = e->p - target->p;
-                int32_t dist_sq = LengthSq(delta);
-                if (dist_sq < 12*12)
-                {
-                    for (Entity *seen: Raycast(e->p, target->p, Raycast_TestSight))
-                    {
-                        if (seen == target)
-                        {
-                            if ((Abs(delta.x) <= 1) &&
-                                (Abs(delta.y) <= 1))
-                            {
-                                TakeDamage(target, BasicDamage(e->handle, 1));
-                                return true;
-                            }
-                            else
-                            {
-                                ScopedMemory crap(&entity_manager->arena);
-                                Path path = FindPath(&entity_manager->arena, e->p, target->p);
-                                if (path.length > 0)
-                                {
-                                    MoveEntity(e, path.positions[0]);
-                                    return true;
-                                }
-                            }
-
-                            break;
-                        }
-                    }
-                }
+                MoveEntity(e, step);
+                return true;
             }
-        }
+        } break;
+
+        default: break;
     }
 
     return false;
 }
 
+struct DecideEntityActJobParams
+{
+    EntityHandle *actors;
+    AiIntent *intents;
+    size_t count;
+};
+
+static
+PLATFORM_JOB(DecideEntityActJob)
+{
+    DecideEntityActJobParams *params = (DecideEntityActJobParams *)args;
+
+    Arena *temp_arena = platform->GetTempArena();
+    for (size_t i = 0; i < params->count; ++i)
+    {
+        ScopedMemory temp(temp_arena);
+
+        Entity *e = EntityFromHandle(params->actors[i]);
+        params->intents[i] = DecideEntityAct(e);
+    }
+}
+
+// NOTE: Not worth waking up the job threads for fewer actors than this
+#define AI_DECIDE_ACTORS_PER_JOB 32
+
+static inline void
+DecideEntityActs(Arena *arena, EntityHandle *actors, AiIntent *intents, size_t count)
+{
+    ProfileScope();
+
+    size_t job_count = (count + AI_DECIDE_ACTORS_PER_JOB - 1) / AI_DECIDE_ACTORS_PER_JOB;
+    DecideEntityActJobParams *jobs = PushArray(arena, job_count, DecideEntityActJobParams);
+    for (size_t job_index = 0; job_index < job_count; ++job_index)
+    {
+        size_t first = job_index*AI_DECIDE_ACTORS_PER_JOB;
+
+        DecideEntityActJobParams *params = &jobs[job_index];
+        params->actors = actors + first;
+        params->intents = intents + first;
+        params->count = count - first;
+        if (params->count > AI_DECIDE_ACTORS_PER_JOB)
+        {
+            params->count = AI_DECIDE_ACTORS_PER_JOB;
+        }
+    }
+
+    if (job_count == 1)
+    {
+        DecideEntityActJob(&jobs[0]);
+    }
+    else
+    {
+        for (size_t job_index = 0; job_index < job_count; ++job_index)
+        {
+            platform->AddJob(platform->high_priority_queue, &jobs[job_index], DecideEntityActJob);
+        }
+        platform->WaitForJobs(platform->high_priority_queue);
+    }
+}
+
+static inline void
+SweepTombstones(void)
+{
+    ProfileScope();
+
+    if (!entity_manager->tombstone_count)
+    {
+        return;
+    }
+
+#if DUNGEONS_SLOW
+    uint32_t journal_count = entity_manager->tombstone_count;
+    if (journal_count > ENTITY_TOMBSTONE_JOURNAL_SIZE)
+    {
+        journal_count = ENTITY_TOMBSTONE_JOURNAL_SIZE;
+    }
+
+    // NOTE: Handle generations are what let us be lazy about this, a dead handle must never
+    // come back to life even if its index got handed out again.
+    for (uint32_t i = 0; i < journal_count; ++i)
+    {
+        Assert(!EntityFromHandle(entity_manager->tombstones[i]));
+    }
+#endif
+
+    for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
+    {
+        Entity *e = iter.entity;
+        if (e->inventory.count)
+        {
+            CleanStaleReferences(&e->inventory);
+        }
+        if (e->forced_hostile_entities.count)
+        {
+            CleanStaleReferences(&e->forced_hostile_entities);
+        }
+    }
+
+    entity_manager->tombstone_count = 0;
+}
+
 static inline void
 NextTurn(void)
 {
@@ -1360,6 +3178,159 @@ NextTurn(void)
     Clear(&entity_manager->turn_arena);
 }
 
+// NOTE: Puts actors that are far enough away from the player (and not in a region the
+// player can see into) to sleep, and wakes up the dormant ones that are close enough or
+// whose region just came into view. Only looks at scheduled actors and the chunks around
+// the player, so it doesn't get slower as the map grows.
+static inline void
+UpdateSimulationRegions(void)
+{
+    ProfileScope();
+
+    Entity *player = entity_manager->player;
+    if (!HasProperty(player, EntityProperty_InWorld))
+    {
+        return;
+    }
+
+    uint32_t update_index = ++entity_manager->region_update_index;
+    V2i player_p = PositionOf(player);
+
+    if (VisibilityGrid *grid = player->visibility_grid)
+    {
+        Rect2i bounds = Intersect(grid->bounds, 0, 0, entity_manager->world_w, entity_manager->world_h);
+        for (int y = bounds.min.y; y < bounds.max.y; ++y)
+        for (int x = bounds.min.x; x < bounds.max.x; ++x)
+        {
+            V2i p = MakeV2i(x, y);
+            SimRegion *region = GetSimRegion(p);
+            if (region && (region->seen_update_index != update_index) && IsVisible(grid, p))
+            {
+                bool came_into_view = (region->seen_update_index + 1 != update_index);
+                region->seen_update_index = update_index;
+                if (came_into_view)
+                {
+                    WakeDormantEntities(region->rect);
+                }
+            }
+        }
+    }
+
+    int radius = entity_manager->active_radius;
+    WakeDormantEntities(MakeRect2iMinMax(player_p - MakeV2i(radius, radius), player_p + MakeV2i(radius + 1, radius + 1)));
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    Entity **sleepers = PushArrayNoClear(temp_arena, entity_manager->schedule_count, Entity *);
+    uint32_t sleeper_count = 0;
+
+    int dormant_radius = radius + SIM_DORMANT_MARGIN;
+    for (uint32_t i = 0; i < entity_manager->schedule_count; ++i)
+    {
+        Entity *e = EntityFromHandle(entity_manager->schedule[i].handle);
+        if ((e == player) || !HasProperty(e, EntityProperty_InWorld))
+        {
+            continue;
+        }
+
+        V2i delta = PositionOf(e) - player_p;
+        if ((Abs(delta.x) <= dormant_radius) && (Abs(delta.y) <= dormant_radius))
+        {
+            continue;
+        }
+
+        SimRegion *region = GetSimRegion(PositionOf(e));
+        if (region && (region->seen_update_index == update_index))
+        {
+            continue;
+        }
+
+        sleepers[sleeper_count++] = e;
+    }
+
+    for (uint32_t i = 0; i < sleeper_count; ++i)
+    {
+        MakeDormant(sleepers[i]);
+    }
+}
+
+// NOTE: Lets every actor that's due before the player's next turn act, in order. If there's
+// no player to wait for, time moves on by one turn.
+static inline void
+RunScheduleUntilPlayerTurn(void)
+{
+    ProfileScope();
+
+    Entity *player = entity_manager->player;
+
+    entity_manager->schedule_round += 1;
+
+    uint64_t until = entity_manager->schedule_time + ENTITY_TURN_TICKS;
+    if (player->schedule_index)
+    {
+        ScheduleEntity(player, entity_manager->schedule_time + GetActionDelay(player));
+        until = GetScheduledTime(player);
+    }
+
+    // NOTE: Everybody due at the same time decides against the same world in parallel, then
+    // the intents get applied serially in schedule order. That order only depends on the
+    // schedule, so replays come out the same no matter how the jobs got spread out.
+    while (entity_manager->schedule_count)
+    {
+        ScheduledActor next = entity_manager->schedule[0];
+        if (EntityFromHandle(next.handle) == player || next.time > until)
+        {
+            break;
+        }
+
+        uint64_t time = next.time;
+        entity_manager->schedule_time = time;
+
+        Arena *temp_arena = platform->GetTempArena();
+        ScopedMemory temp(temp_arena);
+
+        size_t max_actor_count = entity_manager->schedule_count;
+        EntityHandle *actors = PushArrayNoClear(temp_arena, max_actor_count, EntityHandle);
+        AiIntent *intents = PushArrayNoClear(temp_arena, max_actor_count, AiIntent);
+
+        size_t actor_count = 0;
+        while (entity_manager->schedule_count)
+        {
+            ScheduledActor actor = entity_manager->schedule[0];
+            Entity *e = EntityFromHandle(actor.handle);
+            if (e == player || actor.time != time)
+            {
+                break;
+            }
+
+            ScheduleEntity(e, time + GetActionDelay(e));
+            actors[actor_count++] = actor.handle;
+        }
+
+        DecideEntityActs(temp_arena, actors, intents, actor_count);
+
+        for (size_t i = 0; i < actor_count; ++i)
+        {
+            // NOTE: Somebody earlier in the batch might have killed this one off
+            Entity *e = EntityFromHandle(actors[i]);
+            if (!e)
+            {
+                continue;
+            }
+
+            bool did_something = ApplyEntityIntent(e, intents[i]);
+            if (did_something)
+            {
+                NextTurn();
+                e->visibility_grid = PushAndCalculateVisibility(&entity_manager->turn_arena, e);
+            }
+        }
+    }
+
+    entity_manager->schedule_time = until;
+}
+
 static inline void
 WarmUpEntityVisibilityGrids(void)
 {
@@ -1394,6 +3365,39 @@ RenderEntityToSprite(Entity *e)
     return sprite;
 }
 
+// NOTE: Runs everything that happens after the player used up their turn, up until it's
+// their turn again.
+static inline void
+EndPlayerTurn(void)
+{
+    Entity *player = entity_manager->player;
+
+    NextTurn();
+
+    // TODO: This stuff is way messy
+    CalculateVisibilityRecursiveShadowcast(player->visibility_grid, player);
+
+    // NOTE: Volatile things can't be trusted to still be there once you look away.
+    // Things that moved already got marked unseen by MoveEntity.
+    for (EntityIter iter = IterateAllEntities(EntityProperty_Volatile); IsValid(iter); Next(&iter))
+    {
+        if (iter.entity != player)
+        {
+            iter.entity->seen_by_player = false;
+        }
+    }
+
+    UpdateSimulationRegions();
+    RunScheduleUntilPlayerTurn();
+    ResolveEntityEvents();
+
+    // TODO: This stuff is way messy
+    CalculateVisibilityRecursiveShadowcast(player->visibility_grid, player);
+
+    SweepTombstones();
+    MaybeCompactEntities();
+}
+
 static inline void
 UpdateAndRenderEntities(void)
 {
@@ -1406,36 +3410,7 @@ UpdateAndRenderEntities(void)
 
         if (PlayerAct())
         {
-            NextTurn();
-
-            // TODO: This stuff is way messy
-            CalculateVisibilityRecursiveShadowcast(player->visibility_grid, player);
-
-            for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
-            {
-                Entity *e = iter.entity;
-
-                if (e == player)
-                {
-                    continue;
-                }
-
-                // see if the player lost track of us
-                if (!AreEqual(e->p, e->seen_p) || HasProperty(e, EntityProperty_Volatile))
-                {
-                    e->seen_by_player = false;
-                }
-
-                bool did_something = EntityAct(e);
-                if (did_something)
-                {
-                    NextTurn();
-                    e->visibility_grid = PushAndCalculateVisibility(&entity_manager->turn_arena, e);
-                }
-            }
-
-            // TODO: This stuff is way messy
-            CalculateVisibilityRecursiveShadowcast(player->visibility_grid, player);
+            EndPlayerTurn();
         }
     }
     else
@@ -1445,12 +3420,14 @@ UpdateAndRenderEntities(void)
 
     entity_manager->block_simulation = false;
 
+    UpdatePathRequests();
+
     Font *world_font = render_state->world_font;
 
     Entity *player = entity_manager->player;
 
     V2i render_tile_dim = MakeV2i(platform->render_w / world_font->glyph_w, platform->render_h / world_font->glyph_h);
-    render_state->camera_bottom_left = player->p - render_tile_dim / 2;
+    render_state->camera_bottom_left = PositionOf(player) - render_tile_dim / 2;
 
     int viewport_w = (platform->render_w + world_font->glyph_w - 1) / world_font->glyph_w;
     int viewport_h = (platform->render_h + world_font->glyph_h - 1) / world_font->glyph_h;
@@ -1462,62 +3439,78 @@ UpdateAndRenderEntities(void)
     input->ui_mouse_p = ScreenToUi(input->mouse_p);
     input->world_mouse_p = ScreenToWorld(input->mouse_p);
 
-    bool done_animations = true;
     for (int y = viewport.min.y; y <= viewport.max.y; y += 1)
     for (int x = viewport.min.x; x <= viewport.max.x; x += 1)
     {
         V2i p = MakeV2i(x, y);
-        for (Entity *e: GetEntitiesAt(p))
+
+        TerrainTile terrain = GetTerrain(p);
+        if (terrain.kind != Terrain_None &&
+            (game_state->debug_fullbright || SeenByPlayer(game_state->gen_tiles, p)))
         {
-            Sprite sprite = RenderEntityToSprite(e);
-            if (e->sprite_anim_timer >= e->sprite_anim_rate)
+            Sprite sprite = GetTerrainMaterial((TerrainKind)terrain.kind).sprite;
+            if (!game_state->debug_fullbright && !IsVisible(player->visibility_grid, p))
             {
-                e->sprite_anim_timer -= e->sprite_anim_rate;
-                e->sprite_index = e->sprite_index + 1;
-                if (e->sprite_index >= e->sprite_count)
-                {
-                    e->sprite_index = 0;
-                    e->sprite_anim_timer -= e->sprite_anim_pause_time;
-                }
+                sprite.foreground.r = sprite.foreground.r / 2;
+                sprite.foreground.g = sprite.foreground.g / 2;
+                sprite.foreground.b = sprite.foreground.b / 2;
+                sprite.background.r = sprite.background.r / 2;
+                sprite.background.g = sprite.background.g / 2;
+                sprite.background.b = sprite.background.b / 2;
             }
-            e->sprite_anim_timer += platform->dt;
+            DrawTile(Layer_World, p, sprite);
+        }
+    }
 
-            if (e->flash_timer >= 0.0f)
+    bool done_animations = true;
+    Rect2i query_rect = MakeRect2iMinMax(viewport.min, viewport.max + MakeV2i(1, 1));
+    for (Entity *e: QueryRect(platform->GetTempArena(), query_rect))
+    {
+        Sprite sprite = RenderEntityToSprite(e);
+        if (e->sprite_anim_timer >= e->sprite_anim_rate)
+        {
+            e->sprite_anim_timer -= e->sprite_anim_rate;
+            e->sprite_index = e->sprite_index + 1;
+            if (e->sprite_index >= e->sprite_count)
             {
-                e->flash_timer -= platform->dt;
-                done_animations = false;
+                e->sprite_index = 0;
+                e->sprite_anim_timer -= e->sprite_anim_pause_time;
             }
+        }
+        e->sprite_anim_timer += platform->dt;
 
-            if (e->flash_timer <= 0.0f && HasProperty(e, EntityProperty_Dying))
+        if (e->flash_timer >= 0.0f)
+        {
+            e->flash_timer -= platform->dt;
+            done_animations = false;
+        }
+
+        if (e->flash_timer <= 0.0f && HasProperty(e, EntityProperty_Dying))
+        {
+            QueueEntityEvent(EntityEvent_Death, e);
+        }
+
+        bool draw = (HasProperty(e, EntityProperty_InWorld) && e->seen_by_player);
+        draw |= game_state->debug_fullbright;
+        if (draw)
+        {
+            bool visible = IsVisible(player->visibility_grid, PositionOf(e));
+            visible |= game_state->debug_fullbright;
+            if (!visible)
             {
-                KillEntity(e);
+                sprite.foreground.r = sprite.foreground.r / 2;
+                sprite.foreground.g = sprite.foreground.g / 2;
+                sprite.foreground.b = sprite.foreground.b / 2;
+                sprite.background.r = sprite.background.r / 2;
+                sprite.background.g = sprite.background.g / 2;
+                sprite.background.b = sprite.background.b / 2;
             }
-
-            bool draw = (HasProperty(e, EntityProperty_InWorld) && e->seen_by_player);
-            draw |= game_state->debug_fullbright;
-            if (draw)
+            RenderLayer layer = Layer_World;
+            if (!HasProperty(e, EntityProperty_BlockMovement))
             {
-                bool visible = IsVisible(player->visibility_grid, e->p);
-                visible |= game_state->debug_fullbright;
-                if (!visible)
-                {
-                    sprite.foreground.r = sprite.foreground.r / 2;
-                    sprite.foreground.g = sprite.foreground.g / 2;
-                    sprite.foreground.b = sprite.foreground.b / 2;
-                    sprite.background.r = sprite.background.r / 2;
-                    sprite.background.g = sprite.background.g / 2;
-                    sprite.background.b = sprite.background.b / 2;
-                }
-                RenderLayer layer = Layer_World;
-                if (!HasProperty(e, EntityProperty_BlockMovement))
-                {
-                    layer = Layer_Floor;
-                }
-                DrawTile(layer, e->p, sprite);
+                layer = Layer_Floor;
             }
-
-            CleanStaleReferences(&e->inventory);
-            CleanStaleReferences(&e->forced_hostile_entities);
+            DrawTile(layer, PositionOf(e), sprite);
         }
     }
 
@@ -1525,6 +3518,10 @@ UpdateAndRenderEntities(void)
     {
         entity_manager->block_simulation = true;
     }
+
+    // NOTE: Picks up deaths from the loop above, and anything the player did without using
+    // up a turn
+    ResolveEntityEvents();
 }
 
 static inline void
@@ -1578,12 +3575,12 @@ EntityToString(Entity *e, StringList *list)
     SetForeground(list, orig_foreground);
     SetBackground(list, orig_background);
 
-    if (e->inventory.first)
+    if (e->inventory.count)
     {
         PushTempStringF(list, "    Contents:\n");
-        for (Entity *item: Linearize(&e->inventory))
+        for (EntityListIter iter = IterateList(&e->inventory); IsValid(iter); Next(&iter))
         {
-            EntityToString(item, list);            
+            EntityToString(iter.entity, list);
         }
         PushTempStringF(list, "\n");
     }
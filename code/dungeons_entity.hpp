@@ -1,14 +1,23 @@
 #ifndef DUNGEONS_ENTITY_HPP
 #define DUNGEONS_ENTITY_HPP
 
-#define MAX_ENTITY_COUNT (1 << 16)
+// NOTE: This only sizes the address space reserved for entity storage, memory gets
+// committed ENTITY_STORAGE_GROW_COUNT entities at a time as entity_count grows.
+#define MAX_ENTITY_COUNT (1 << 22)
+#define ENTITY_STORAGE_GROW_COUNT 4096
+#define ENTITY_COMPACTION_THRESHOLD 0.75f
+#define ENTITY_CHUNK_SIZE_LOG2 5
+#define ENTITY_CHUNK_SIZE (1 << ENTITY_CHUNK_SIZE_LOG2)
 #define ENTITY_HASH_SIZE 8192
-
-struct Path
-{
-    uint32_t length;
-    V2i *positions;
-};
+#define ENTITY_TOMBSTONE_JOURNAL_SIZE 256
+#define ENTITY_TURN_TICKS 100
+#define AI_ENGAGEMENT_RADIUS 12
+#define MAX_DIJKSTRA_MAPS 4
+#define DIJKSTRA_UNREACHABLE INT32_MAX
+#define SIM_ACTIVE_RADIUS 32
+#define SIM_DORMANT_MARGIN 8
+#define SIM_NOISE_RADIUS 8
+#define MAX_SIM_REGIONS 1024
 
 enum EntityPropertyKind
 {
@@ -32,6 +41,52 @@ struct EntityPropertySet
     uint64_t properties[(EntityProperty_COUNT + 63) / 64];
 };
 
+// NOTE: Sparse set of entity slot indices. There's one of these per property, holding every
+// live entity that has that property, so that iterating "all entities with property X" costs
+// O(members) rather than O(entity_count).
+struct EntityIndexSet
+{
+    uint32_t count;
+    uint32_t *dense;
+    uint32_t *sparse;
+};
+
+// NOTE: Static terrain lives in its own per-tile layer rather than as entities, since walls
+// vastly outnumber everything else in a generated map and never move, act or change.
+enum TerrainKind
+{
+    Terrain_None,
+    Terrain_Wall,
+    Terrain_RoomWall,
+    Terrain_COUNT,
+};
+
+typedef uint8_t TerrainFlags;
+enum
+{
+    TerrainFlag_BlockMovement = 0x1,
+    TerrainFlag_BlockSight    = 0x2,
+};
+
+struct TerrainTile
+{
+    uint8_t kind;
+    TerrainFlags flags;
+};
+
+struct TerrainMaterial
+{
+    Sprite sprite;
+    TerrainFlags flags;
+};
+
+// NOTE: One bit per tile, row-major, so that whole rows can be tested 64 tiles at a time.
+struct TileBitplane
+{
+    int words_per_row;
+    uint64_t *words;
+};
+
 struct EntityHandle
 {
     uint32_t index;
@@ -57,18 +112,81 @@ NullEntityHandle(void)
     return result;
 }
 
+//
+// NOTE: A Dijkstra map holds the distance from every tile in the world to a target, over the
+// tiles that don't block pathing. Straight steps cost 2 and diagonal ones 3, which is close
+// enough to 1 and sqrt(2) while keeping the costs small integers. Stepping downhill on it
+// leads to the target, stepping uphill runs away from it, and any number of entities can
+// share one. The actual distance of a tile is distances[index] + bias, see
+// UpdateDijkstraMap for why.
+//
+
+struct DijkstraMap
+{
+    EntityHandle target;
+    V2i target_p;
+    uint32_t pathing_version;
+    uint32_t last_used_turn;
+    uint32_t last_used_round;
+
+    int32_t bias;
+    int32_t *distances;
+};
+
 struct Entity;
+struct Pathfinder;
+struct RoomGraph;
+struct PathCache;
+struct PathRequests;
+
+//
+// NOTE: Entity lists are small vectors of handles. Most inventories and grudges only hold a
+// handful of entities, so the first ENTITY_LIST_INLINE_COUNT handles live in the list itself.
+// Past that they move to a block taken from a pool on the EntityManager, which doubles in size
+// as it fills up. A handle keeps its index until something in front of it is removed.
+//
 
-struct EntityNode
+#define ENTITY_LIST_INLINE_COUNT 4
+#define ENTITY_LIST_SIZE_CLASS_COUNT 24
+
+struct EntityList
 {
-    EntityNode *next;
-    EntityHandle handle;
+    uint32_t count;
+    uint32_t capacity; // NOTE: 0 while the handles are stored inline
+    union
+    {
+        EntityHandle inline_handles[ENTITY_LIST_INLINE_COUNT];
+        EntityHandle *handles;
+    };
 };
 
-struct EntityList
+struct EntityListFreeBlock
+{
+    EntityListFreeBlock *next;
+};
+
+//
+// NOTE: Once an inventory outgrows its inline handles it also gets a stack index, an open
+// addressed table from stack signature to the item holding that stack, so AddToInventory finds
+// what to stack onto with a probe rather than a walk over the whole inventory. Items that leave
+// an inventory alive have to come out of the index with RemoveFromStackIndex. Items that die
+// are left in, their handles go stale and the slot gets reused. The slot blocks are pooled the
+// same way as EntityList blocks.
+//
+
+#define STACK_INDEX_MIN_CAPACITY 16
+
+struct StackIndexSlot
 {
-    EntityNode *first;
-    EntityNode *last;
+    uint64_t signature; // NOTE: 0 for a slot that was never used
+    EntityHandle item;  // NOTE: Null once removed, probes still go past it
+};
+
+struct StackIndex
+{
+    uint32_t used_count; // NOTE: Slots with a signature, removed and stale ones included
+    uint32_t capacity;   // NOTE: 0 until the inventory needs one, a power of two after
+    StackIndexSlot *slots;
 };
 
 typedef Array<Entity *> EntityArray;
@@ -93,6 +211,7 @@ enum FactionKind
     Faction_None,
     Faction_Human,
     Faction_Monster,
+    Faction_COUNT,
 };
 
 static inline const char *
@@ -123,23 +242,48 @@ struct DamageDescriptor
     int32_t amount;
 };
 
+// NOTE: Damage, triggers, pickups and deaths don't happen on the spot, they get queued up as
+// events and ResolveEntityEvents applies them all in one go, one kind at a time in the order
+// of this enum. That way nothing gets killed or moved while somebody is iterating the world.
+enum EntityEventKind
+{
+    EntityEvent_None,
+    EntityEvent_Damage,
+    EntityEvent_Trigger,
+    EntityEvent_PickUp,
+    EntityEvent_Death,
+    EntityEvent_COUNT,
+};
+
+struct EntityEvent
+{
+    EntityEventKind kind;
+    EntityHandle subject;
+    EntityHandle other; // NOTE: The aggressor for damage, who bumped into the subject for triggers, who's picking it up for pickups
+    int32_t amount;
+};
+
 struct VisibilityGrid
 {
     Rect2i bounds;
     bool *tiles;
 };
 
+// NOTE: This is the cold part of an entity. The hot part (handle, position, properties
+// and speed) lives in parallel arrays on the EntityManager, indexed by the same slot
+// index, so that scans over all entities don't drag names, inventories and sprites through
+// the cache. Use HandleFromEntity, PositionOf, SpeedOf and the property functions.
 struct Entity
 {
-    EntityHandle handle;
+    Entity *next_on_tile;
 
-    union
-    {
-        Entity *next_on_tile;
-        Entity *next_free;
-    };
+    // NOTE: Hash of the fields that decide whether two items stack (name, faction, contact
+    // trigger, sprites and properties), see GetStackSignature. 0 means it needs recomputing,
+    // so anything that changes those fields has to reset it.
+    uint64_t stack_signature;
 
     EntityList inventory;
+    StackIndex inventory_stack_index;
     EntityList forced_hostile_entities;
 
     String name;
@@ -147,6 +291,11 @@ struct Entity
     AiKind ai;
     FactionKind faction;
 
+    uint32_t schedule_index; // NOTE: 1-based position in the schedule heap, 0 if not scheduled
+
+    bool dormant;
+    uint64_t dormant_resume_time; // NOTE: When it was due to act as it went dormant, WakeEntity picks up from there
+
     TriggerKind contact_trigger;
 
     EntityHandle required_key;
@@ -162,16 +311,12 @@ struct Entity
     int32_t uses;
     int32_t amount;
 
-    V2i p;
     int32_t health;
     int32_t max_health;
 
     float flash_timer;
     Color flash_color;
 
-    int32_t speed;
-    int32_t energy;
-
     float sprite_anim_rate;
     float sprite_anim_timer;
     float sprite_anim_pause_time;
@@ -179,8 +324,64 @@ struct Entity
     int16_t sprite_index;
     Sprite sprites[4];
     Sprite sprites_locked[4];
+};
 
-    uint64_t properties[(EntityProperty_COUNT + 63) / 64];
+enum PrefabKind
+{
+    Prefab_None,
+    Prefab_Door,
+    Prefab_Player,
+    Prefab_Orc,
+    Prefab_Gold,
+    Prefab_Chest,
+    Prefab_SmallGem,
+    Prefab_COUNT,
+};
+
+// NOTE: A prefab is a ready-made image of an entity, spawning one is a copy of the image into
+// a free slot instead of building the entity up field by field.
+struct EntityPrefab
+{
+    Entity image;
+    EntityPropertySet properties;
+    int32_t speed;
+};
+
+// NOTE: The spatial grid is split into ENTITY_CHUNK_SIZE^2 chunks which are only allocated
+// once something is put in them, so empty stretches of the world cost one pointer per chunk.
+// Tiles within a chunk are row-major, same as everything else that walks the map.
+struct EntityChunk
+{
+    uint32_t occupancy; // NOTE: How many entities are on the tiles of this chunk, so queries can skip empty chunks
+    uint32_t faction_occupancy[Faction_COUNT]; // NOTE: The same, per faction, so hostility queries can skip chunks with no enemies
+    uint32_t dormant_occupancy; // NOTE: And for dormant actors, so waking things up can skip chunks with nobody asleep
+    Entity *tiles[ENTITY_CHUNK_SIZE*ENTITY_CHUNK_SIZE];
+};
+
+//
+// NOTE: Actors (the player and anything with an ai) take their turns in order of the time
+// they're next ready to act, kept in a binary min-heap. Time is counted in ticks, an entity
+// with speed 100 acts once every ENTITY_TURN_TICKS, one with speed 200 twice as often.
+//
+
+struct ScheduledActor
+{
+    uint64_t time;
+    uint32_t sequence; // NOTE: Breaks ties between actors due at the same time, first come first served
+    EntityHandle handle;
+};
+
+//
+// NOTE: Actors far away from the player go dormant, which takes them out of the schedule
+// until something wakes them up again, so the cost of a turn depends on what's going on
+// around the player and not on the size of the map. Regions (the rooms worldgen made) keep
+// everyone in them awake while the player can see any part of the room.
+//
+
+struct SimRegion
+{
+    Rect2i rect;
+    uint32_t seen_update_index; // NOTE: The last UpdateSimulationRegions the player could see into it
 };
 
 struct EntityManager
@@ -201,150 +402,382 @@ struct EntityManager
     Entity *looking_at_container;
     bool looking_at_ground;
 
-    Entity null_entity;
-
     int container_selection_index;
 
-    EntityNode *first_free_entity_node;
-
-    Entity *first_free_entity;
-    Entity entities[MAX_ENTITY_COUNT];
-    Entity *entity_grid[WORLD_SIZE_X][WORLD_SIZE_Y];
+    uint64_t schedule_time;
+    uint32_t schedule_sequence;
+    uint32_t schedule_count;
+    ScheduledActor *schedule;
+    uint32_t schedule_round; // NOTE: Goes up once per RunScheduleUntilPlayerTurn
+
+    // NOTE: Free overflow blocks for EntityLists, one free list per block size.
+    EntityListFreeBlock *free_list_blocks[ENTITY_LIST_SIZE_CLASS_COUNT];
+    EntityListFreeBlock *free_stack_index_blocks[ENTITY_LIST_SIZE_CLASS_COUNT];
+
+    // NOTE: KillEntity journals the handles it kills here. EntityLists hang on to handles of
+    // dead entities (iterating a list skips them) until SweepTombstones repairs them all at
+    // the end of the turn, and when nothing died there's nothing to sweep. Past
+    // ENTITY_TOMBSTONE_JOURNAL_SIZE kills only the count goes up.
+    uint32_t tombstone_count;
+    EntityHandle tombstones[ENTITY_TOMBSTONE_JOURNAL_SIZE];
+
+    // NOTE: Events queued up since the last ResolveEntityEvents. The array doubles in size on
+    // event_arena when it fills up, which gets cleared once they're resolved.
+    Arena event_arena;
+    uint32_t event_count;
+    uint32_t event_capacity;
+    EntityEvent *events;
+
+    //
+    // NOTE: Entities can be moved to a different slot by CompactEntities, so handles don't name
+    // a slot directly but an entry in handle_slots. Free slots are tracked in a bitmap so that
+    // AddEntity can always hand out the lowest free slot and keep the live set packed towards
+    // the front, entity_count is the high-water mark and drops as the top slots free up.
+    //
+
+    uint32_t handle_count;
+    uint32_t free_handle_count;
+    uint32_t *free_handles;
+    uint32_t *handle_slots;
+    uint32_t *handle_generations;
+
+    uint32_t lowest_free_slot_word;
+    uint64_t *free_slots;
+
+    uint32_t compaction_count;
+    uint32_t compaction_moved_count;
+
+    EntityPrefab prefabs[Prefab_COUNT];
+
+    EntityIndexSet property_sets[EntityProperty_COUNT];
+
+    int world_w;
+    int world_h;
+
+    int chunk_count_x;
+    int chunk_count_y;
+    EntityChunk **chunks;
+
+    TerrainTile *terrain;
+
+    // NOTE: These mirror whether the terrain or any entity on a tile has BlockMovement /
+    // BlockSight, and are kept up to date by UpdateTileBlocking whenever the terrain changes or
+    // entities move or change properties.
+    TileBitplane block_movement;
+    TileBitplane block_sight;
+
+    // NOTE: Like block_movement, but leaving out actors, which will have moved out of the way
+    // soon enough. This is what pathfinding plans around, and pathing_version goes up whenever
+    // it changes so things built on top of it know to rebuild.
+    TileBitplane block_pathing;
+    uint32_t pathing_version;
+    uint32_t *chunk_pathing_versions; // NOTE: The pathing_version as of the last change in each chunk
+
+    DijkstraMap dijkstra_maps[MAX_DIJKSTRA_MAPS];
+    Pathfinder *pathfinder;
+    RoomGraph *room_graph;
+    PathCache *path_cache;
+    PathRequests *path_requests;
+
+    int active_radius; // NOTE: Actors go dormant a bit past this, and wake up within it
+    uint32_t region_update_index;
+    uint32_t region_count;
+    SimRegion *regions;   // NOTE: Region 0 is the null region, for tiles that aren't in any
+    uint16_t *tile_regions;
+
+    //
+    // NOTE: Slot 0 is reserved for the null entity, which is what the player points at after
+    // dying. Its hot data stays zeroed, so it never passes a property filter.
+    //
+    // All the per-entity arrays (including the handle tables and property sets above) live in
+    // their own reserved ranges of MAX_ENTITY_COUNT elements, of which entity_capacity are
+    // committed. Growing them never moves anything, so Entity pointers stay put.
+    //
+
+    uint32_t entity_capacity;
+
+    EntityHandle *entity_handles;
+    V2i *entity_positions;
+    EntityPropertySet *entity_properties;
+    int32_t *entity_speed;
+
+    Entity *entities;
 };
 GLOBAL_STATE(EntityManager, entity_manager);
 
-static inline EntityNode *NewEntityNode(EntityHandle handle);
-static inline void FreeEntityNode(EntityNode *node);
 static inline Entity *EntityFromHandle(EntityHandle handle);
+static inline void UpdateTileBlocking(V2i p);
+static inline void InitializePrefabs(void);
 static inline EntityHandle HandleFromEntity(Entity *entity);
 
+static inline uint32_t
+EntityIndex(Entity *e)
+{
+    return (uint32_t)(e - entity_manager->entities);
+}
+
+static inline Entity *
+GetNullEntity(void)
+{
+    return &entity_manager->entities[0];
+}
+
+static inline V2i
+PositionOf(Entity *e)
+{
+    return entity_manager->entity_positions[EntityIndex(e)];
+}
+
+static inline int32_t
+SpeedOf(Entity *e)
+{
+    return entity_manager->entity_speed[EntityIndex(e)];
+}
+
+static inline EntityPropertySet *
+PropertiesOf(Entity *e)
+{
+    return &entity_manager->entity_properties[EntityIndex(e)];
+}
+
+static inline bool
+IsInSet(EntityIndexSet *set, uint32_t index)
+{
+    uint32_t at = set->sparse[index];
+    return ((at < set->count) && (set->dense[at] == index));
+}
+
 static inline void
-SetProperty(Entity *e, EntityPropertyKind property)
+AddToSet(EntityIndexSet *set, uint32_t index)
 {
-    if (e)
-    {
-        e->properties[property / 64] |= 1ull << (property % 64);
-    }
+    AssertSlow(!IsInSet(set, index));
+    set->sparse[index] = set->count;
+    set->dense[set->count++] = index;
 }
 
 static inline void
-SetProperty(Entity *e, EntityPropertySet set)
+RelocateInSet(EntityIndexSet *set, uint32_t from_index, uint32_t to_index)
 {
-    if (e)
-    {
-        for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
-        {
-            e->properties[i] |= set.properties[i];
-        }
-    }
+    AssertSlow(IsInSet(set, from_index) && !IsInSet(set, to_index));
+    uint32_t at = set->sparse[from_index];
+    set->dense[at] = to_index;
+    set->sparse[to_index] = at;
 }
 
 static inline void
-UnsetProperty(Entity *e, EntityPropertyKind property)
+RemoveFromSet(EntityIndexSet *set, uint32_t index)
 {
-    if (e)
+    AssertSlow(IsInSet(set, index));
+    uint32_t at = set->sparse[index];
+    uint32_t last = set->dense[--set->count];
+    set->dense[at] = last;
+    set->sparse[last] = at;
+}
+
+static constexpr bool
+HasProperty(const EntityPropertySet *set, EntityPropertyKind property)
+{
+    return !!(set->properties[property / 64] & (1ull << (property % 64)));
+}
+
+static constexpr EntityPropertySet
+SetProperty(EntityPropertySet set, EntityPropertyKind property)
+{
+    set.properties[property / 64] |= 1ull << (property % 64);
+    return set;
+}
+
+static constexpr EntityPropertySet
+CombineSet(EntityPropertySet a, EntityPropertySet b)
+{
+    EntityPropertySet result = a;
+    for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
     {
-        e->properties[property / 64] &= ~(1ull << (property % 64));
+        result.properties[i] |= b.properties[i];
     }
+    return result;
 }
 
-static inline bool
-HasProperty(Entity *e, EntityPropertyKind property)
+template <EntityPropertyKind... kinds>
+static constexpr EntityPropertySet
+MakePropertyMask(void)
 {
-    bool result = false;
-    if (e)
+    EntityPropertySet result = {};
+    const EntityPropertyKind list[] = { EntityProperty_None, kinds... };
+    for (size_t i = 1; i < ArrayCount(list); ++i)
     {
-        result = !!(e->properties[property / 64] & (1ull << (property % 64)));
+        result = SetProperty(result, list[i]);
     }
     return result;
 }
 
+// NOTE: Property sets known at compile time, e.g. PropertyMask<EntityProperty_BlockMovement,
+// EntityProperty_BlockSight>, which fold down to constant words.
+template <EntityPropertyKind... kinds>
+static constexpr EntityPropertySet PropertyMask = MakePropertyMask<kinds...>();
+
+template <size_t page_count>
 static inline bool
-HasProperties(Entity *e, EntityPropertySet set)
+HasPropertiesPaged(const uint64_t *properties, const uint64_t *set)
 {
-    bool result = false;
-    if (e)
+    for (size_t i = 0; i < page_count; ++i)
     {
-        result = true;
-        for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
+        if ((properties[i] & set[i]) != set[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: EntityProperty_COUNT fits in a single page today, so filter tests are one AND/compare.
+template <>
+inline bool
+HasPropertiesPaged<1>(const uint64_t *properties, const uint64_t *set)
+{
+    return (properties[0] & set[0]) == set[0];
+}
+
+// NOTE: Properties that come and go with where an entity is rather than what it is, so they're
+// left out of the stack signature.
+static constexpr EntityPropertySet stack_unhashed_properties = PropertyMask<EntityProperty_InWorld>;
+
+static inline void
+ChangeProperties(Entity *e, EntityPropertySet new_properties)
+{
+    // NOTE: An entity is a member of a property set if it has that property and is alive,
+    // so this is the one place that has to keep the sets in sync with the property bits.
+    uint32_t index = EntityIndex(e);
+    EntityPropertySet *properties = PropertiesOf(e);
+
+    // NOTE: Only touch the cold record when the signature actually goes stale, moving things
+    // around flips InWorld all the time.
+    bool signature_changed = false;
+    for (size_t page = 0; page < EntityProperty_PAGECOUNT; ++page)
+    {
+        signature_changed |= !!((properties->properties[page] ^ new_properties.properties[page]) &
+                                ~stack_unhashed_properties.properties[page]);
+    }
+    if (signature_changed)
+    {
+        e->stack_signature = 0;
+    }
+
+    bool was_alive = HasProperty(properties, EntityProperty_Alive);
+    bool is_alive = HasProperty(&new_properties, EntityProperty_Alive);
+
+    constexpr EntityPropertySet blocking = PropertyMask<EntityProperty_BlockMovement, EntityProperty_BlockSight>;
+
+    bool blocking_changed = false;
+    for (size_t page = 0; page < EntityProperty_PAGECOUNT; ++page)
+    {
+        uint64_t was_members = (was_alive ? properties->properties[page] : 0);
+        uint64_t is_members = (is_alive ? new_properties.properties[page] : 0);
+        uint64_t changed = was_members ^ is_members;
+        while (changed)
         {
-            if ((e->properties[i] & set.properties[i]) != set.properties[i])
+            uint32_t bit = FindLeastSignificantSetBit(changed).index;
+            changed &= changed - 1;
+
+            EntityIndexSet *set = &entity_manager->property_sets[64*page + bit];
+            if (is_members & (1ull << bit))
             {
-                result = false;
-                break;
+                AddToSet(set, index);
+            }
+            else
+            {
+                RemoveFromSet(set, index);
             }
         }
+
+        blocking_changed |= !!((properties->properties[page] ^ new_properties.properties[page]) & blocking.properties[page]);
+    }
+
+    *properties = new_properties;
+
+    if (blocking_changed && HasProperty(properties, EntityProperty_InWorld))
+    {
+        UpdateTileBlocking(PositionOf(e));
     }
-    return result;
 }
 
 static inline void
-SetProperties(Entity *e, EntityPropertySet set)
+SetProperty(Entity *e, EntityPropertyKind property)
 {
     if (e)
     {
-        for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
-        {
-            e->properties[i] |= set.properties[i];
-        }
+        EntityPropertySet properties = *PropertiesOf(e);
+        properties.properties[property / 64] |= 1ull << (property % 64);
+        ChangeProperties(e, properties);
     }
 }
 
-static inline EntityPropertySet
-SetProperty(EntityPropertySet set, EntityPropertyKind property)
+static inline void
+SetProperty(Entity *e, EntityPropertySet set)
 {
-    set.properties[property / 64] |= 1ull << (property % 64);
-    return set;
+    if (e)
+    {
+        EntityPropertySet properties = *PropertiesOf(e);
+        for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
+        {
+            properties.properties[i] |= set.properties[i];
+        }
+        ChangeProperties(e, properties);
+    }
 }
 
 static inline void
-UnsetProperty(EntityPropertySet *set, EntityPropertyKind property)
+UnsetProperty(Entity *e, EntityPropertyKind property)
 {
-    set->properties[property / 64] &= ~(1ull << (property % 64));
+    if (e)
+    {
+        EntityPropertySet properties = *PropertiesOf(e);
+        properties.properties[property / 64] &= ~(1ull << (property % 64));
+        ChangeProperties(e, properties);
+    }
 }
 
 static inline bool
-HasProperty(EntityPropertySet *set, EntityPropertyKind property)
+HasProperty(Entity *e, EntityPropertyKind property)
 {
-    bool result = !!(set->properties[property / 64] & (1ull << (property % 64)));
+    bool result = false;
+    if (e)
+    {
+        result = !!(PropertiesOf(e)->properties[property / 64] & (1ull << (property % 64)));
+    }
     return result;
 }
 
-#define MakeEntityPropertySet(...) MakeEntityPropertySet_(__VA_ARGS__, EntityProperty_None)
-static inline EntityPropertySet
-MakeEntityPropertySet_(EntityPropertyKind first, ...)
+static inline bool
+HasProperties(const EntityPropertySet *properties, const EntityPropertySet &set)
 {
-    EntityPropertySet result = {};
-    result = SetProperty(result, first);
+    return HasPropertiesPaged<EntityProperty_PAGECOUNT>(properties->properties, set.properties);
+}
 
-    va_list args;
-    va_start(args, first);
-    for (;;)
+static inline bool
+HasProperties(Entity *e, const EntityPropertySet &set)
+{
+    bool result = false;
+    if (e)
     {
-        EntityPropertyKind prop = va_arg(args, EntityPropertyKind);
-        if (prop == EntityProperty_None)
-        {
-            break;
-        }
-
-        result = SetProperty(result, prop);
+        result = HasProperties(PropertiesOf(e), set);
     }
-
     return result;
 }
 
-static inline EntityPropertySet
-CombineSet(EntityPropertySet a, EntityPropertySet b)
+static inline void
+SetProperties(Entity *e, EntityPropertySet set)
 {
-    EntityPropertySet result = a;
-    for (size_t i = 0; i < EntityProperty_PAGECOUNT; ++i)
-    {
-        result.properties[i] |= b.properties[i];
-    }
-    return result;
+    SetProperty(e, set);
 }
 
-static inline EntityPropertySet
+static inline void
+UnsetProperty(EntityPropertySet *set, EntityPropertyKind property)
+{
+    set->properties[property / 64] &= ~(1ull << (property % 64));
+}
+
+static constexpr EntityPropertySet
 operator | (EntityPropertyKind a, EntityPropertyKind b)
 {
     EntityPropertySet result = {};
@@ -353,14 +786,14 @@ operator | (EntityPropertyKind a, EntityPropertyKind b)
     return result;
 }
 
-static inline EntityPropertySet
+static constexpr EntityPropertySet
 operator | (EntityPropertySet set, EntityPropertyKind prop)
 {
     set = SetProperty(set, prop);
     return set;
 }
 
-static inline EntityPropertySet
+static constexpr EntityPropertySet
 operator | (EntityPropertySet a, EntityPropertySet b)
 {
     EntityPropertySet result = CombineSet(a, b);
@@ -381,12 +814,10 @@ operator |= (EntityPropertySet &a, EntityPropertySet b)
     return a;
 }
 
-static inline EntityPropertySet
+static constexpr EntityPropertySet
 MakeSet(EntityPropertyKind prop)
 {
-    EntityPropertySet set = {};
-    set |= prop;
-    return set;
+    return SetProperty(EntityPropertySet {}, prop);
 }
 
 #endif /* DUNGEONS_ENTITY_HPP */
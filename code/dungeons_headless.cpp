@@ -0,0 +1,756 @@
+//
+// NOTE: Headless mode, for soak and throughput testing. Generates a world and runs the
+// simulation for a fixed number of turns as fast as it'll go: the player is driven by a
+// policy instead of input, nothing gets rendered and nothing waits for animations. Run it
+// through a platform layer that calls AppRunHeadless, like linux_headless_dungeons.cpp.
+//
+
+#include <stdlib.h>
+
+enum HeadlessPolicy
+{
+    HeadlessPolicy_RandomWalk,
+    HeadlessPolicy_Wait,
+    HeadlessPolicy_Script,
+};
+
+struct HeadlessOptions
+{
+    int turn_count;
+    uint64_t world_seed;
+    uint64_t policy_seed;
+    int monster_count;
+    int chase_target_count;
+    bool hostile_monsters;
+    bool immortal_player;
+    bool run_benchmarks;
+    bool check_path_requests;
+    bool check_path_cache;
+
+    HeadlessPolicy policy;
+    const char *script; // NOTE: Numpad directions, 1-9 with 5 to wait, played on repeat
+};
+
+static inline void
+PrintHeadlessUsage(void)
+{
+    platform->LogPrint(PlatformLogLevel_Info,
+                       "usage: [--turns N] [--seed N] [--monsters N] [--chase-targets N] [--hostile] [--immortal]\n"
+                       "       [--policy random|wait] [--script 12346789] [--policy-seed N] [--benchmarks]\n"
+                       "       [--check-path-requests] [--check-path-cache]");
+}
+
+static inline bool
+ParseHeadlessOptions(int argument_count, char **arguments, HeadlessOptions *options)
+{
+    options->turn_count = 1000;
+    options->world_seed = 0xDEADBEFC;
+    options->policy_seed = 1;
+    options->policy = HeadlessPolicy_RandomWalk;
+
+    for (int i = 1; i < argument_count; ++i)
+    {
+        const char *argument = arguments[i];
+        const char *value = (i + 1 < argument_count ? arguments[i + 1] : nullptr);
+
+        bool takes_value = true;
+        if (AreEqual(argument, "--hostile"))
+        {
+            options->hostile_monsters = true;
+            takes_value = false;
+        }
+        else if (AreEqual(argument, "--immortal"))
+        {
+            options->immortal_player = true;
+            takes_value = false;
+        }
+        else if (AreEqual(argument, "--benchmarks"))
+        {
+            options->run_benchmarks = true;
+            takes_value = false;
+        }
+        else if (AreEqual(argument, "--check-path-requests"))
+        {
+            options->check_path_requests = true;
+            takes_value = false;
+        }
+        else if (AreEqual(argument, "--check-path-cache"))
+        {
+            options->check_path_cache = true;
+            takes_value = false;
+        }
+        else if (!value)
+        {
+            PrintHeadlessUsage();
+            return false;
+        }
+        else if (AreEqual(argument, "--turns"))
+        {
+            options->turn_count = atoi(value);
+        }
+        else if (AreEqual(argument, "--seed"))
+        {
+            options->world_seed = strtoull(value, nullptr, 0);
+        }
+        else if (AreEqual(argument, "--policy-seed"))
+        {
+            options->policy_seed = strtoull(value, nullptr, 0);
+        }
+        else if (AreEqual(argument, "--monsters"))
+        {
+            options->monster_count = atoi(value);
+        }
+        else if (AreEqual(argument, "--chase-targets"))
+        {
+            options->chase_target_count = atoi(value);
+        }
+        else if (AreEqual(argument, "--policy"))
+        {
+            if      (AreEqual(value, "random")) options->policy = HeadlessPolicy_RandomWalk;
+            else if (AreEqual(value, "wait"))   options->policy = HeadlessPolicy_Wait;
+            else
+            {
+                PrintHeadlessUsage();
+                return false;
+            }
+        }
+        else if (AreEqual(argument, "--script"))
+        {
+            options->policy = HeadlessPolicy_Script;
+            options->script = value;
+        }
+        else
+        {
+            PrintHeadlessUsage();
+            return false;
+        }
+
+        if (takes_value)
+        {
+            i += 1;
+        }
+    }
+
+    if (options->policy == HeadlessPolicy_Script && !options->script[0])
+    {
+        options->policy = HeadlessPolicy_Wait;
+    }
+
+    return true;
+}
+
+static inline V2i
+GetHeadlessPlayerMove(HeadlessOptions *options, RandomSeries *entropy, int turn_index)
+{
+    V2i result = MakeV2i(0, 0);
+    switch (options->policy)
+    {
+        case HeadlessPolicy_RandomWalk:
+        {
+            result = MakeV2i(RandomRange(entropy, -1, 1), RandomRange(entropy, -1, 1));
+        } break;
+
+        case HeadlessPolicy_Script:
+        {
+            size_t script_length = CStringLength(options->script);
+            char c = options->script[(size_t)turn_index % script_length];
+            if (c >= '1' && c <= '9')
+            {
+                int digit = c - '1';
+                result = MakeV2i(digit % 3 - 1, digit / 3 - 1);
+            }
+        } break;
+
+        default: break;
+    }
+    return result;
+}
+
+static inline void
+SpawnHeadlessMonsters(HeadlessOptions *options, RandomSeries *entropy)
+{
+    GenTiles *tiles = game_state->gen_tiles;
+    Entity *player = entity_manager->player;
+
+    int spawned = 0;
+    for (int attempt = 0; attempt < 64*options->monster_count && spawned < options->monster_count; ++attempt)
+    {
+        V2i p = MakeV2i(RandomRange(entropy, 0, tiles->w - 1), RandomRange(entropy, 0, tiles->h - 1));
+        if (Walkable(GetTile(tiles, p)) && !TileBlocked(p))
+        {
+            Entity *orc = AddOrc(p);
+            if (options->hostile_monsters)
+            {
+                AddToListUnique(&orc->forced_hostile_entities, HandleFromEntity(player));
+            }
+            spawned += 1;
+        }
+    }
+
+    if (spawned < options->monster_count)
+    {
+        platform->LogPrint(PlatformLogLevel_Warning, "Only found room for %d of %d monsters",
+                           spawned, options->monster_count);
+    }
+}
+
+// NOTE: Returns a random walkable, unblocked tile within radius of center, or false if a few
+// tries didn't turn one up.
+static inline bool
+FindHeadlessSpawnTile(RandomSeries *entropy, V2i center, int radius, V2i *result)
+{
+    GenTiles *tiles = game_state->gen_tiles;
+    for (int attempt = 0; attempt < 64; ++attempt)
+    {
+        V2i p = center + MakeV2i(RandomRange(entropy, -radius, radius), RandomRange(entropy, -radius, radius));
+        if (IsInWorld(p) && Walkable(GetTile(tiles, p)) && !TileBlocked(p))
+        {
+            *result = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+#define HEADLESS_CHASERS_PER_TARGET 8
+
+// NOTE: Spawns targets around the player, each with a pack of monsters out to get it. The
+// targets follow the player around and can't be killed, so the chasing keeps going. With more
+// targets than MAX_DIJKSTRA_MAPS it can't all be done on Dijkstra maps, so this is what
+// exercises the path cache and the path requests behind it. Returns how many chasers it spawned.
+static inline int
+SpawnHeadlessChaseTargets(HeadlessOptions *options, RandomSeries *entropy)
+{
+    Entity *player = entity_manager->player;
+    V2i player_p = PositionOf(player);
+
+    int spawned = 0;
+    int chaser_count = 0;
+    for (int target_index = 0; target_index < options->chase_target_count; ++target_index)
+    {
+        V2i target_p;
+        if (!FindHeadlessSpawnTile(entropy, player_p, entity_manager->active_radius / 2, &target_p))
+        {
+            continue;
+        }
+
+        // NOTE: DecideEntityAct only goes after what its sight raycast stops on, so the targets
+        // need to block sight like the player does
+        Entity *target = AddOrc(target_p);
+        SetProperty(target, EntityProperty_Invulnerable);
+        SetProperty(target, EntityProperty_BlockSight);
+        AddToListUnique(&target->forced_hostile_entities, HandleFromEntity(player));
+        spawned += 1;
+
+        for (int chaser_index = 0; chaser_index < HEADLESS_CHASERS_PER_TARGET; ++chaser_index)
+        {
+            V2i chaser_p;
+            if (FindHeadlessSpawnTile(entropy, target_p, AI_ENGAGEMENT_RADIUS / 2, &chaser_p))
+            {
+                Entity *chaser = AddOrc(chaser_p);
+                AddToListUnique(&chaser->forced_hostile_entities, HandleFromEntity(target));
+                chaser_count += 1;
+            }
+        }
+    }
+
+    if (spawned < options->chase_target_count)
+    {
+        platform->LogPrint(PlatformLogLevel_Warning, "Only found room for %d of %d chase targets",
+                           spawned, options->chase_target_count);
+    }
+    return chaser_count;
+}
+
+#if DUNGEONS_INTERNAL
+static inline void
+PrintHeadlessProfile(double seconds_per_clock, int turn_count)
+{
+    // NOTE: Profile zones nest, so these are inclusive timings. Selection sort, there aren't many.
+    uint32_t count = debug_state->entry_count;
+    DebugEntry *sorted[ArrayCount(debug_state->entries)];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        sorted[i] = &debug_state->entries[i];
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        for (uint32_t j = i + 1; j < count; ++j)
+        {
+            if (sorted[j]->clocks > sorted[i]->clocks)
+            {
+                Swap(sorted[i], sorted[j]);
+            }
+        }
+    }
+
+    platform->LogPrint(PlatformLogLevel_Info, "%-32s %12s %12s %12s", "zone", "hits", "total ms", "ms/turn");
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        DebugEntry *entry = sorted[i];
+        double ms = 1000.0*seconds_per_clock*(double)entry->clocks;
+        platform->LogPrint(PlatformLogLevel_Info, "%-32s %12llu %12.3f %12.4f",
+                           entry->name, (unsigned long long)entry->hit_count, ms, ms / (double)turn_count);
+    }
+}
+#endif
+
+static inline bool
+GenerateHeadlessWorld(HeadlessOptions *options)
+{
+    game_state->gen_tiles = BeginGenerateWorld(options->world_seed);
+    platform->WaitForJobs(platform->low_priority_queue);
+    game_state->world_generated = EndGenerateWorld(&game_state->gen_tiles);
+    if (!game_state->world_generated)
+    {
+        platform->ReportError(PlatformError_Fatal, "World generation did not complete");
+    }
+    return game_state->world_generated;
+}
+
+// NOTE: For the self checks, counts into whatever failure_count is in scope
+#define HEADLESS_CHECK(condition, ...)                                                  \
+    if (!(condition))                                                                   \
+    {                                                                                   \
+        platform->LogPrint(PlatformLogLevel_Error, "check failed: " __VA_ARGS__);       \
+        failure_count += 1;                                                             \
+    }
+
+// NOTE: Runs frames the way RunHeadless does until the request is done, returns how many it took
+static inline int
+WaitForHeadlessPathRequest(PathTicket ticket, int max_frame_count)
+{
+    int result = 0;
+    while ((PollPathRequest(ticket).status == PathRequest_Pending) && (result < max_frame_count))
+    {
+        UpdatePathRequests();
+        platform->WaitForJobs(platform->low_priority_queue);
+        result += 1;
+    }
+    return result;
+}
+
+// NOTE: Checks that a search too big for one job's node budget gets spread out over several
+// frames and still comes back with the path FindPath finds, and that unreachable goals and
+// released requests get cleaned up. Returns the number of checks that failed.
+static inline int
+CheckPathRequests(HeadlessOptions *options)
+{
+    if (!GenerateHeadlessWorld(options))
+    {
+        return 1;
+    }
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    int failure_count = 0;
+
+    // NOTE: Open all the doors, like the pathfinding benchmark, so there are long paths to find
+    for (EntityIter iter = IterateAllEntities(EntityProperty_Door); IsValid(iter); Next(&iter))
+    {
+        UnsetProperty(iter.entity, EntityProperty_BlockMovement);
+        UnsetProperty(iter.entity, EntityProperty_BlockSight);
+    }
+
+    GenTiles *tiles = game_state->gen_tiles;
+    size_t corridor_count = 0;
+    V2i *corridors = PushArrayNoClear(temp_arena, (size_t)tiles->w*tiles->h, V2i);
+    for (int y = 0; y < tiles->h; y += 1)
+    for (int x = 0; x < tiles->w; x += 1)
+    {
+        V2i p = MakeV2i(x, y);
+        if ((GetTile(tiles, p) == GenTile_Corridor) && !TileBlocksPathing(p))
+        {
+            corridors[corridor_count++] = p;
+        }
+    }
+
+    Pathfinder *pathfinder = GetPathfinder();
+
+    PathOptions options_astar = {};
+    options_astar.mode = PathMode_AStar;
+
+    // NOTE: Go for the pair of corridor tiles that takes the most nodes to get between, out of a few
+    RandomSeries entropy = MakeRandomSeries(options->policy_seed);
+    V2i start = {};
+    V2i target = {};
+    uint32_t target_expanded_count = 0;
+    for (int attempt = 0; corridor_count && (attempt < 32); attempt += 1)
+    {
+        V2i from = corridors[RandomChoice(&entropy, (uint32_t)corridor_count)];
+        V2i to = corridors[RandomChoice(&entropy, (uint32_t)corridor_count)];
+
+        ScopedMemory path_temp(temp_arena);
+        Path path = FindPath(pathfinder, temp_arena, from, to, options_astar);
+        if (path.length && (pathfinder->expanded_count > target_expanded_count))
+        {
+            start = from;
+            target = to;
+            target_expanded_count = pathfinder->expanded_count;
+        }
+    }
+
+    HEADLESS_CHECK(target_expanded_count > 2*PATH_REQUEST_NODE_BUDGET,
+                   "no target far enough away to need more than one job (%u nodes)", target_expanded_count);
+
+    // NOTE: With the room graph the request would only search up to a waypoint, that gets its
+    // own check further down
+    RoomGraph *room_graph = entity_manager->room_graph;
+    entity_manager->room_graph = nullptr;
+
+    Path expected = FindPath(pathfinder, temp_arena, start, target, options_astar);
+
+    PathTicket ticket = RequestPath(start, target, options_astar);
+    int frame_count = WaitForHeadlessPathRequest(ticket, 1000);
+    PathRequestResult result = PollPathRequest(ticket);
+
+    HEADLESS_CHECK(result.status == PathRequest_Found, "long request came back with status %d", result.status);
+    HEADLESS_CHECK((uint32_t)frame_count > target_expanded_count / PATH_REQUEST_NODE_BUDGET,
+                   "%u nodes done in %d frames, over budget", target_expanded_count, frame_count);
+
+    uint32_t expected_length = (expected.length < PATH_REQUEST_MAX_LENGTH ? expected.length : PATH_REQUEST_MAX_LENGTH);
+    bool same_path = (result.path.length == expected_length);
+    for (uint32_t i = 0; same_path && (i < expected_length); ++i)
+    {
+        same_path = AreEqual(result.path.positions[i], expected.positions[i]);
+    }
+    HEADLESS_CHECK(same_path, "long request found a different path than FindPath");
+
+    platform->LogPrint(PlatformLogLevel_Info, "Path request for %u nodes took %d frames at %d nodes per frame",
+                       target_expanded_count, frame_count, PATH_REQUEST_NODE_BUDGET);
+
+    ReleasePathRequest(ticket);
+    HEADLESS_CHECK(PollPathRequest(ticket).status == PathRequest_Invalid, "released ticket still valid");
+
+    entity_manager->room_graph = room_graph;
+
+    // NOTE: Through the room graph, the same request should come back with the way to a waypoint
+    // in range, in fewer frames
+    {
+        PathTicket leg_ticket = RequestPath(start, target, options_astar);
+        int leg_frame_count = WaitForHeadlessPathRequest(leg_ticket, 1000);
+        PathRequestResult leg = PollPathRequest(leg_ticket);
+
+        HEADLESS_CHECK(leg.status == PathRequest_Found, "room graph request came back with status %d", leg.status);
+        HEADLESS_CHECK(leg_frame_count < frame_count, "room graph request took %d frames, more than %d without",
+                       leg_frame_count, frame_count);
+        if (leg.path.length)
+        {
+            V2i leg_end = leg.path.positions[leg.path.length - 1];
+            HEADLESS_CHECK(GetRoomGraphNodeAt(room_graph, leg_end) &&
+                           (GetOctileDistance(start, leg_end) <= PATH_STRAIGHT_COST*PATH_REQUEST_ROOM_GRAPH_DISTANCE),
+                           "room graph request ended at (%d, %d), not a waypoint in range", leg_end.x, leg_end.y);
+
+            Path expected_leg = FindPath(pathfinder, temp_arena, start, leg_end, options_astar);
+            HEADLESS_CHECK(GetPathCost(start, leg.path) == GetPathCost(start, expected_leg),
+                           "room graph request's leg is longer than FindPath's");
+        }
+        ReleasePathRequest(leg_ticket);
+    }
+
+    // NOTE: Walling off the way across a stretch of corridor has to show up in the edge between
+    // its ends, and taking the wall away again has to put the edge back how it was
+    uint32_t checked_cluster = 0;
+    for (uint32_t cluster_index = (uint32_t)tiles->room_count + 1;
+         !checked_cluster && (cluster_index < room_graph->cluster_count);
+         ++cluster_index)
+    {
+        RoomGraphCluster *cluster = &room_graph->clusters[cluster_index];
+        for (uint32_t i = 0; !checked_cluster && (i < cluster->node_count); ++i)
+        for (uint32_t j = i + 1; !checked_cluster && (j < cluster->node_count); ++j)
+        {
+            uint32_t a = room_graph->cluster_nodes[cluster->first_node + i];
+            uint32_t b = room_graph->cluster_nodes[cluster->first_node + j];
+            RoomGraphEdge *edge = FindRoomGraphEdge(room_graph, a, b);
+            V2i a_p = room_graph->nodes[a].p;
+            V2i b_p = room_graph->nodes[b].p;
+            if (!edge || (edge->cost < 0) || AreRoomGraphNeighbors(a_p, b_p))
+            {
+                continue;
+            }
+
+            // NOTE: The shortest way between them might not go through the cluster at all
+            ScopedMemory wall_temp(temp_arena);
+            Path path = FindPath(pathfinder, temp_arena, a_p, b_p);
+            uint32_t wall_count = (path.length ? path.length - 1 : 0);
+            bool inside = (wall_count > 0);
+            for (uint32_t k = 0; inside && (k < wall_count); ++k)
+            {
+                inside = (GetRoomGraphClusterAt(room_graph, path.positions[k]) == cluster_index);
+            }
+            if (!inside)
+            {
+                continue;
+            }
+            checked_cluster = cluster_index;
+
+            TerrainTile *saved = PushArrayNoClear(temp_arena, wall_count, TerrainTile);
+
+            int32_t cost_before = edge->cost;
+            for (uint32_t k = 0; k < wall_count; ++k)
+            {
+                V2i p = path.positions[k];
+                saved[k] = entity_manager->terrain[p.y*entity_manager->world_w + p.x];
+                SetTerrain(p, Terrain_Wall);
+            }
+
+            HEADLESS_CHECK(cluster->dirty, "walling off cluster %u didn't mark it dirty", cluster_index);
+            RefreshRoomGraph(room_graph);
+            int32_t cost_walled = edge->cost;
+            HEADLESS_CHECK((cost_walled != cost_before) &&
+                           (cost_walled == GetRoomGraphEdgeCost(pathfinder, temp_arena, a_p, b_p)),
+                           "edge across cluster %u cost %d before the wall and %d after", cluster_index,
+                           cost_before, cost_walled);
+
+            for (uint32_t k = 0; k < wall_count; ++k)
+            {
+                V2i p = path.positions[k];
+                entity_manager->terrain[p.y*entity_manager->world_w + p.x] = saved[k];
+                UpdateTileBlocking(p);
+            }
+
+            RefreshRoomGraph(room_graph);
+            HEADLESS_CHECK(edge->cost == cost_before, "edge across cluster %u cost %d once the wall was gone, not %d",
+                           cluster_index, edge->cost, cost_before);
+
+            platform->LogPrint(PlatformLogLevel_Info, "Room graph edge across cluster %u went from %d to %d and back",
+                               cluster_index, cost_before, cost_walled);
+        }
+    }
+    HEADLESS_CHECK(checked_cluster, "no corridor with an edge across it to wall off");
+
+    // NOTE: Out of bounds never gets going, and a request released before it's done must not
+    // hold on to its slot
+    PathTicket unreachable = RequestPath(start, MakeV2i(-1, -1));
+    WaitForHeadlessPathRequest(unreachable, 1000);
+    HEADLESS_CHECK(PollPathRequest(unreachable).status == PathRequest_NotFound, "unreachable request wasn't NotFound");
+    ReleasePathRequest(unreachable);
+
+    PathTicket abandoned = RequestPath(start, target, options_astar);
+    UpdatePathRequests();
+    ReleasePathRequest(abandoned);
+    platform->WaitForJobs(platform->low_priority_queue);
+    UpdatePathRequests();
+    platform->WaitForJobs(platform->low_priority_queue);
+
+    uint32_t used_count = 0;
+    for (uint32_t i = 0; i < MAX_PATH_REQUESTS; ++i)
+    {
+        used_count += (entity_manager->path_requests->requests[i].status != PathRequest_Invalid);
+    }
+    HEADLESS_CHECK(used_count == 0, "%u requests still taken after releasing them all", used_count);
+    HEADLESS_CHECK(entity_manager->path_requests->queue_count == 0, "queue not empty after releasing everything");
+
+    platform->LogPrint(failure_count ? PlatformLogLevel_Error : PlatformLogLevel_Info,
+                       "Path request checks: %d failed", failure_count);
+    return failure_count;
+}
+
+struct HeadlessRunStats
+{
+    int chaser_count;
+};
+
+static inline int
+RunHeadless(HeadlessOptions *options, HeadlessRunStats *stats = nullptr)
+{
+    PlatformHighResTime worldgen_start = platform->GetTime();
+
+    if (!GenerateHeadlessWorld(options))
+    {
+        return 1;
+    }
+
+    RandomSeries entropy = MakeRandomSeries(options->policy_seed);
+    SpawnHeadlessMonsters(options, &entropy);
+    int chaser_count = SpawnHeadlessChaseTargets(options, &entropy);
+    if (stats)
+    {
+        stats->chaser_count = chaser_count;
+    }
+    WarmUpEntityVisibilityGrids();
+
+    double worldgen_seconds = platform->SecondsElapsed(worldgen_start, platform->GetTime());
+    platform->LogPrint(PlatformLogLevel_Info, "World generated in %.3fms, %u entities",
+                       1000.0*worldgen_seconds, entity_manager->entity_count - 1);
+
+#if DUNGEONS_INTERNAL
+    // NOTE: Throw away whatever got profiled during world generation
+    AppDebugEndFrame();
+    debug_state->entry_count = 0;
+    uint64_t clock_start = __rdtsc();
+#endif
+
+    PlatformHighResTime start = platform->GetTime();
+
+    int turn_index = 0;
+    for (; turn_index < options->turn_count; ++turn_index)
+    {
+        Entity *player = entity_manager->player;
+        if (HasProperty(player, EntityProperty_Alive))
+        {
+            if (options->immortal_player)
+            {
+                player->health = Max(player->health, 1);
+                UnsetProperty(player, EntityProperty_Dying);
+            }
+
+            player->visibility_grid = PushAndCalculateVisibility(&entity_manager->turn_arena, player);
+
+            V2i move = GetHeadlessPlayerMove(options, &entropy, turn_index);
+            if (!AreEqual(move, MakeV2i(0, 0)))
+            {
+                PlayerTryMove(move);
+            }
+        }
+
+        EndPlayerTurn();
+
+        // NOTE: Nobody's waiting for the death flash, so the dying go right away
+        for (EntityIter iter = IterateAllEntities(EntityProperty_Dying); IsValid(iter); Next(&iter))
+        {
+            if (iter.entity != entity_manager->player || !options->immortal_player)
+            {
+                QueueEntityEvent(EntityEvent_Death, iter.entity);
+            }
+        }
+        ResolveEntityEvents();
+
+        // NOTE: There's no frame to keep smooth here, so wait for the path requests. The node
+        // budget doesn't depend on timing, which keeps runs reproducible.
+        UpdatePathRequests();
+        platform->WaitForJobs(platform->low_priority_queue);
+
+        Clear(platform->GetTempArena());
+
+#if DUNGEONS_INTERNAL
+        AppDebugEndFrame();
+#endif
+    }
+
+    double seconds = platform->SecondsElapsed(start, platform->GetTime());
+
+    uint32_t dormant_count = 0;
+    uint32_t actor_count = 0;
+    for (EntityIter iter = IterateAllEntities(); IsValid(iter); Next(&iter))
+    {
+        if (IsActor(iter.entity))
+        {
+            actor_count += 1;
+            dormant_count += iter.entity->dormant;
+        }
+    }
+
+    platform->LogPrint(PlatformLogLevel_Info, "%d turns in %.3fs, %.1f turns/s, %.4fms/turn",
+                       turn_index, seconds, (double)turn_index / seconds, 1000.0*seconds / (double)turn_index);
+    platform->LogPrint(PlatformLogLevel_Info, "%u actors, %u dormant, %u scheduled, player %s",
+                       actor_count, dormant_count, entity_manager->schedule_count,
+                       HasProperty(entity_manager->player, EntityProperty_Alive) ? "alive" : "dead");
+
+#if DUNGEONS_INTERNAL
+    uint64_t clocks = __rdtsc() - clock_start;
+    PrintHeadlessProfile(seconds / (double)clocks, turn_index);
+#else
+    platform->LogPrint(PlatformLogLevel_Info, "Per-system timings need a DUNGEONS_INTERNAL build");
+#endif
+
+    return 0;
+}
+
+// NOTE: Runs the chase scenario with more chasers than the path cache has entries, and checks
+// that they share it without throwing away each other's requests. Returns the number of checks
+// that failed.
+static inline int
+CheckPathCache(HeadlessOptions *options)
+{
+    if (!options->chase_target_count)
+    {
+        options->chase_target_count = 64;
+    }
+    options->immortal_player = true;
+
+    HeadlessRunStats stats = {};
+    if (RunHeadless(options, &stats))
+    {
+        return 1;
+    }
+
+    int failure_count = 0;
+
+    // NOTE: More chasers than sets, so some of them have to share
+    int chaser_count = stats.chaser_count;
+    HEADLESS_CHECK(chaser_count > PATH_CACHE_SIZE / PATH_CACHE_WAYS,
+                   "only %d chasers, not enough to have to share sets", chaser_count);
+
+    PathCache *cache = entity_manager->path_cache;
+    HEADLESS_CHECK(cache && cache->collected_count, "the chasers never got a path back");
+    if (cache)
+    {
+        uint32_t in_flight_count = 0;
+        for (uint32_t i = 0; i < PATH_CACHE_SIZE; ++i)
+        {
+            in_flight_count += !!cache->entries[i].ticket.generation;
+        }
+
+        platform->LogPrint(PlatformLogLevel_Info,
+                           "Path cache: %d chasers, %u requested, %u collected, %u dropped, %u in flight, %u times full",
+                           chaser_count, cache->requested_count, cache->collected_count, cache->dropped_count,
+                           in_flight_count, cache->full_count);
+
+        HEADLESS_CHECK(cache->requested_count == cache->collected_count + cache->dropped_count + in_flight_count,
+                       "requests went missing");
+
+        // NOTE: Requests only get dropped when their owner died, which the odd chaser the player
+        // runs into does, so they should be few and far between
+        HEADLESS_CHECK(20*cache->dropped_count <= cache->requested_count,
+                       "%u of %u requests dropped before they came back", cache->dropped_count, cache->requested_count);
+    }
+
+    platform->LogPrint(failure_count ? PlatformLogLevel_Error : PlatformLogLevel_Info,
+                       "Path cache checks: %d failed", failure_count);
+    return failure_count;
+}
+
+int
+AppRunHeadless(Platform *platform_, int argument_count, char **arguments)
+{
+    platform = platform_;
+#if DUNGEONS_INTERNAL
+    debug_table = platform->debug_table;
+#endif
+
+    game_state = BootstrapPushStruct(GameState, permanent_arena);
+    platform->persistent_app_data = game_state;
+    platform->app_initialized = true;
+
+    HeadlessOptions options = {};
+    if (!ParseHeadlessOptions(argument_count, arguments, &options))
+    {
+        return 1;
+    }
+
+    if (options.run_benchmarks)
+    {
+#if DUNGEONS_INTERNAL
+        RunBenchmarks();
+        return 0;
+#else
+        platform->LogPrint(PlatformLogLevel_Error, "The benchmarks need a DUNGEONS_INTERNAL build");
+        return 1;
+#endif
+    }
+
+    if (options.check_path_requests)
+    {
+        return (CheckPathRequests(&options) ? 1 : 0);
+    }
+
+    if (options.check_path_cache)
+    {
+        return (CheckPathCache(&options) ? 1 : 0);
+    }
+
+    return RunHeadless(&options);
+}
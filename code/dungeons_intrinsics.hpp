@@ -1,7 +1,11 @@
 #ifndef DUNGEONS_INTRINSICS_HPP
 #define DUNGEONS_INTRINSICS_HPP
 
+#if COMPILER_MSVC
 #include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 #include <immintrin.h>
 #include <xmmintrin.h>
 #include <wmmintrin.h>
@@ -27,7 +31,7 @@ RotateLeft(uint32_t value, int32_t amount)
     uint32_t result = _rotl(value, amount);
 #else
     amount &= 31;
-    uint32_t result = ((value <<  amount) | (value >> (32 - amount)));
+    uint32_t result = ((value <<  amount) | (value >> ((32 - amount) & 31)));
 #endif
 
     return result;
@@ -40,7 +44,7 @@ RotateRight(uint32_t value, int32_t amount)
     uint32_t result = _rotr(value, amount);
 #else
     amount &= 31;
-    uint32_t result = ((value >>  amount) | (value << (32 - amount)));
+    uint32_t result = ((value >>  amount) | (value << ((32 - amount) & 31)));
 #endif
     return result;
 }
@@ -72,6 +76,23 @@ FindLeastSignificantSetBit(uint32_t value)
     return result;
 }
 
+static inline BitScanResult
+FindLeastSignificantSetBit(uint64_t value)
+{
+    BitScanResult result = {};
+
+#if COMPILER_MSVC
+    result.found = _BitScanForward64((unsigned long*)&result.index, value);
+#else
+    if (value)
+    {
+        result.found = true;
+        result.index = (uint32_t)__builtin_ctzll(value);
+    }
+#endif
+    return result;
+}
+
 static inline uint64_t
 ExtractU64(__m128i v, int index)
 {
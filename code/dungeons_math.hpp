@@ -17,7 +17,7 @@
 
 // Constructor functions
 
-#if COMPILER_MSVC
+#if COMPILER_MSVC || COMPILER_GCC
 #define MakeVectorInternal(type, ...) type { __VA_ARGS__ }
 #else
 #define MakeVectorInternal(type, ...) (type) { __VA_ARGS__ }
@@ -61,7 +61,7 @@ DUNGEONS_INLINE V4i MakeV4i(V3i xyz, int32_t w) { return MakeVectorInternal(V4i,
 DUNGEONS_INLINE V4i MakeV4i(int32_t x, V3i yzw) { return MakeVectorInternal(V4i, x, yzw[0], yzw[1], yzw[2]); }
 DUNGEONS_INLINE V4i MakeV4i(int32_t x, int32_t y, int32_t z, int32_t w) { return MakeVectorInternal(V4i, x, y, z, w); }
 
-#if COMPILER_MSVC
+#if COMPILER_MSVC || COMPILER_GCC
 
 #define IMPLEMENT_V2_VECTOR_OPERATORS(type, scalar_type, op) \
     DUNGEONS_INLINE type                                     \
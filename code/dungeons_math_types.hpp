@@ -1,7 +1,8 @@
 #ifndef DUNGEONS_MATH_TYPES_HPP
 #define DUNGEONS_MATH_TYPES_HPP
 
-#if COMPILER_MSVC
+// NOTE: GCC has no ext_vector_type, so it gets the plain structs like MSVC does
+#if COMPILER_MSVC || COMPILER_GCC
 struct V2
 {
     union
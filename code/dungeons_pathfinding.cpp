@@ -0,0 +1,1745 @@
+static const V2i path_moves[] =
+{
+    MakeV2i(-1, -1), MakeV2i( 1, -1), MakeV2i(-1, 1), MakeV2i( 1,  1),
+    MakeV2i(-1,  0), MakeV2i( 1,  0), MakeV2i( 0, 1), MakeV2i( 0, -1),
+};
+
+static inline void
+InitializePathfinder(Pathfinder *pathfinder, Arena *arena, int w, int h)
+{
+    size_t tile_count = (size_t)w*h;
+
+    ZeroStruct(pathfinder);
+    pathfinder->arena = arena;
+    pathfinder->w = w;
+    pathfinder->h = h;
+    pathfinder->block_pathing = &entity_manager->block_pathing;
+    pathfinder->tiles = PushArray(arena, tile_count, PathTile);
+    pathfinder->heap = PushArrayNoClear(arena, tile_count, PathHeapEntry);
+}
+
+static inline Pathfinder *
+GetPathfinder(void)
+{
+    if (!entity_manager->pathfinder)
+    {
+        entity_manager->pathfinder = PushStruct(&entity_manager->arena, Pathfinder);
+        InitializePathfinder(entity_manager->pathfinder, &entity_manager->arena, entity_manager->world_w, entity_manager->world_h);
+    }
+    return entity_manager->pathfinder;
+}
+
+static inline int32_t
+GetOctileDistance(V2i a, V2i b)
+{
+    int32_t dx = Abs(b.x - a.x);
+    int32_t dy = Abs(b.y - a.y);
+    int32_t diagonal = Min(dx, dy);
+    int32_t straight = Max(dx, dy) - diagonal;
+    int32_t result = PATH_STRAIGHT_COST*straight + PATH_DIAGONAL_COST*diagonal;
+    return result;
+}
+
+static inline int32_t
+GetPathStepCost(V2i move)
+{
+    return (move.x && move.y) ? PATH_DIAGONAL_COST : PATH_STRAIGHT_COST;
+}
+
+// NOTE: The unit step from one tile towards another, or zero if they're the same
+static inline V2i
+GetPathDirection(V2i from, V2i to)
+{
+    V2i result = Clamp(to - from, MakeV2i(-1, -1), MakeV2i(1, 1));
+    return result;
+}
+
+static inline void
+BeginPathSearch(Pathfinder *pathfinder)
+{
+    pathfinder->generation += 1;
+    if (pathfinder->generation == 0)
+    {
+        // NOTE: Wrapped around, so old stamps could pass for current ones. Clear them out, once
+        // every four billion searches.
+        size_t tile_count = (size_t)pathfinder->w*pathfinder->h;
+        for (size_t i = 0; i < tile_count; ++i)
+        {
+            pathfinder->tiles[i].generation = 0;
+        }
+        pathfinder->generation = 1;
+    }
+
+    pathfinder->heap_count = 0;
+    pathfinder->expanded_count = 0;
+}
+
+// NOTE: Ties on f go to the entry closest to the target, which keeps A* from fanning out
+// across every equally good tile in open areas.
+static inline bool
+PathHeapLess(PathHeapEntry a, PathHeapEntry b)
+{
+    return (a.f < b.f) || ((a.f == b.f) && (a.h < b.h));
+}
+
+static inline void
+SetPathHeapEntry(Pathfinder *pathfinder, uint32_t heap_index, PathHeapEntry entry)
+{
+    pathfinder->heap[heap_index] = entry;
+    pathfinder->tiles[entry.tile_index].heap_index = heap_index;
+}
+
+static inline void
+SiftPathHeapUp(Pathfinder *pathfinder, uint32_t heap_index)
+{
+    PathHeapEntry entry = pathfinder->heap[heap_index];
+    while (heap_index > 0)
+    {
+        uint32_t parent_index = (heap_index - 1) / 2;
+        PathHeapEntry parent = pathfinder->heap[parent_index];
+        if (!PathHeapLess(entry, parent))
+        {
+            break;
+        }
+        SetPathHeapEntry(pathfinder, heap_index, parent);
+        heap_index = parent_index;
+    }
+    SetPathHeapEntry(pathfinder, heap_index, entry);
+}
+
+static inline void
+SiftPathHeapDown(Pathfinder *pathfinder, uint32_t heap_index)
+{
+    PathHeapEntry entry = pathfinder->heap[heap_index];
+    for (;;)
+    {
+        uint32_t child_index = 2*heap_index + 1;
+        if (child_index >= pathfinder->heap_count)
+        {
+            break;
+        }
+        if ((child_index + 1 < pathfinder->heap_count) &&
+            PathHeapLess(pathfinder->heap[child_index + 1], pathfinder->heap[child_index]))
+        {
+            child_index += 1;
+        }
+
+        PathHeapEntry child = pathfinder->heap[child_index];
+        if (!PathHeapLess(child, entry))
+        {
+            break;
+        }
+        SetPathHeapEntry(pathfinder, heap_index, child);
+        heap_index = child_index;
+    }
+    SetPathHeapEntry(pathfinder, heap_index, entry);
+}
+
+// NOTE: Either pushes the tile or, if it's already open, lowers its f in place. A tile is in
+// the heap at most once, so the heap never holds more than one entry per tile.
+static inline void
+PushOrDecreasePathHeap(Pathfinder *pathfinder, uint32_t tile_index, int32_t f, int32_t h)
+{
+    PathHeapEntry entry = { f, h, tile_index };
+
+    PathTile *tile = &pathfinder->tiles[tile_index];
+    uint32_t heap_index = tile->heap_index;
+    if (heap_index == PATH_NOT_IN_HEAP)
+    {
+        heap_index = pathfinder->heap_count++;
+    }
+    pathfinder->heap[heap_index] = entry;
+    SiftPathHeapUp(pathfinder, heap_index);
+}
+
+static inline uint32_t
+PopPathHeap(Pathfinder *pathfinder)
+{
+    Assert(pathfinder->heap_count > 0);
+
+    uint32_t result = pathfinder->heap[0].tile_index;
+    pathfinder->tiles[result].heap_index = PATH_NOT_IN_HEAP;
+
+    pathfinder->heap_count -= 1;
+    if (pathfinder->heap_count > 0)
+    {
+        pathfinder->heap[0] = pathfinder->heap[pathfinder->heap_count];
+        SiftPathHeapDown(pathfinder, 0);
+    }
+
+    return result;
+}
+
+// NOTE: Consecutive nodes on the parent chain are always in a straight or diagonal line from
+// each other. For A* they're neighbours, for jump point search there can be a long run of
+// tiles in between, which get filled back in here.
+static inline Path
+ReconstructPath(Pathfinder *pathfinder, Arena *arena, uint32_t start_index, uint32_t target_index)
+{
+    Path result = {};
+
+    int w = pathfinder->w;
+
+    uint32_t path_length = 0;
+    for (uint32_t index = target_index; index != start_index;)
+    {
+        uint32_t parent = pathfinder->tiles[index].parent;
+        V2i delta = MakeV2i((int)(index % w), (int)(index / w)) - MakeV2i((int)(parent % w), (int)(parent / w));
+        path_length += (uint32_t)Max(Abs(delta.x), Abs(delta.y));
+        index = parent;
+    }
+
+    result.length = path_length;
+    result.positions = PushArrayNoClear(arena, result.length, V2i);
+
+    uint32_t i = path_length;
+    for (uint32_t index = target_index; index != start_index;)
+    {
+        uint32_t parent = pathfinder->tiles[index].parent;
+        V2i parent_p = MakeV2i((int)(parent % w), (int)(parent / w));
+        V2i p = MakeV2i((int)(index % w), (int)(index / w));
+        V2i step = GetPathDirection(p, parent_p);
+        for (; !AreEqual(p, parent_p); p += step)
+        {
+            result.positions[--i] = p;
+        }
+        index = parent;
+    }
+
+    return result;
+}
+
+// NOTE: The search itself only looks at the pathfinder, never the entity manager, so it can
+// run on a job thread against a snapshot of the blocking.
+static inline bool
+IsInPathfinderBounds(Pathfinder *pathfinder, V2i p)
+{
+    return ((p.x >= 0) &&
+            (p.y >= 0) &&
+            (p.x < pathfinder->w) &&
+            (p.y < pathfinder->h));
+}
+
+static inline bool
+PathTileOpen(Pathfinder *pathfinder, V2i p, V2i target)
+{
+    bool open = (IsInPathfinderBounds(pathfinder, p) &&
+                 !(GetBitplaneRow(pathfinder->block_pathing, p.y)[p.x / 64] & (1ull << (p.x % 64))));
+    return open || AreEqual(p, target);
+}
+
+//
+// NOTE: Jump point search. On a uniform cost grid most of the paths A* looks at are
+// permutations of the same moves, so jump point search only considers paths that go
+// diagonal first, then straight, and only stops to put a node in the open set where an
+// obstacle forces a turn that the canonical ordering wouldn't otherwise take. Diagonal moves
+// only need the destination to be open (as with the Dijkstra maps and A*), so the forced
+// neighbour rules are the ones from the original paper, which allows cutting corners.
+//
+
+static inline bool
+JumpStraight(Pathfinder *pathfinder, V2i p, V2i direction, V2i target, V2i *jump_point)
+{
+    V2i side = MakeV2i(direction.y, direction.x);
+    for (;;)
+    {
+        p += direction;
+        if (!PathTileOpen(pathfinder, p, target))
+        {
+            return false;
+        }
+
+        if (AreEqual(p, target) ||
+            (!PathTileOpen(pathfinder, p + side, target) && PathTileOpen(pathfinder, p + side + direction, target)) ||
+            (!PathTileOpen(pathfinder, p - side, target) && PathTileOpen(pathfinder, p - side + direction, target)))
+        {
+            *jump_point = p;
+            return true;
+        }
+    }
+}
+
+static inline bool
+JumpDiagonal(Pathfinder *pathfinder, V2i p, V2i direction, V2i target, V2i *jump_point)
+{
+    V2i horizontal = MakeV2i(direction.x, 0);
+    V2i vertical = MakeV2i(0, direction.y);
+    for (;;)
+    {
+        p += direction;
+        if (!PathTileOpen(pathfinder, p, target))
+        {
+            return false;
+        }
+
+        V2i ignored;
+        if (AreEqual(p, target) ||
+            (!PathTileOpen(pathfinder, p - horizontal, target) && PathTileOpen(pathfinder, p - horizontal + vertical, target)) ||
+            (!PathTileOpen(pathfinder, p - vertical, target) && PathTileOpen(pathfinder, p - vertical + horizontal, target)) ||
+            JumpStraight(pathfinder, p, horizontal, target, &ignored) ||
+            JumpStraight(pathfinder, p, vertical, target, &ignored))
+        {
+            *jump_point = p;
+            return true;
+        }
+    }
+}
+
+// NOTE: Fills in the directions worth jumping in from p, having arrived there travelling in
+// the given direction. From the start, which wasn't arrived at from anywhere, that's all of them.
+static inline size_t
+GetJumpDirections(Pathfinder *pathfinder, V2i p, V2i direction, V2i target, V2i *directions)
+{
+    size_t count = 0;
+    if (AreEqual(direction, MakeV2i(0, 0)))
+    {
+        for (size_t i = 0; i < ArrayCount(path_moves); ++i)
+        {
+            directions[count++] = path_moves[i];
+        }
+    }
+    else if (direction.x && direction.y)
+    {
+        V2i horizontal = MakeV2i(direction.x, 0);
+        V2i vertical = MakeV2i(0, direction.y);
+        directions[count++] = direction;
+        directions[count++] = horizontal;
+        directions[count++] = vertical;
+        if (!PathTileOpen(pathfinder, p - horizontal, target)) directions[count++] = vertical - horizontal;
+        if (!PathTileOpen(pathfinder, p - vertical, target))   directions[count++] = horizontal - vertical;
+    }
+    else
+    {
+        V2i side = MakeV2i(direction.y, direction.x);
+        directions[count++] = direction;
+        if (!PathTileOpen(pathfinder, p + side, target)) directions[count++] = direction + side;
+        if (!PathTileOpen(pathfinder, p - side, target)) directions[count++] = direction - side;
+    }
+    return count;
+}
+
+// NOTE: Opens up next_p, or improves on how it was reached before
+static inline void
+RelaxPathNode(Pathfinder *pathfinder, uint32_t index, V2i next_p, int32_t next_g, V2i target, int32_t max_cost)
+{
+    int32_t next_h = GetOctileDistance(next_p, target);
+    if (next_g + next_h > max_cost)
+    {
+        return;
+    }
+
+    uint32_t next_index = (uint32_t)(next_p.y*pathfinder->w + next_p.x);
+
+    PathTile *next = &pathfinder->tiles[next_index];
+    if (next->generation == pathfinder->generation)
+    {
+        // NOTE: With a consistent heuristic closed tiles never improve, and open ones
+        // only when this is a shorter way in.
+        if ((next->heap_index == PATH_NOT_IN_HEAP) || (next_g >= next->g))
+        {
+            return;
+        }
+    }
+    else
+    {
+        next->generation = pathfinder->generation;
+        next->heap_index = PATH_NOT_IN_HEAP;
+    }
+
+    next->g = next_g;
+    next->parent = index;
+    PushOrDecreasePathHeap(pathfinder, next_index, next_g + next_h, next_h);
+}
+
+// NOTE: Sets up a search from start to target, to be run with ContinuePathSearch. Returns
+// false if it's over before it started: either end is off the map, they're the same tile, or
+// the target is further away than the limits allow.
+static inline bool
+StartPathSearch(Pathfinder *pathfinder, V2i start, V2i target, PathOptions options)
+{
+    if (!IsInPathfinderBounds(pathfinder, start) ||
+        !IsInPathfinderBounds(pathfinder, target) ||
+        AreEqual(start, target))
+    {
+        return false;
+    }
+
+    int32_t max_cost = (options.max_distance ? PATH_STRAIGHT_COST*options.max_distance : INT32_MAX);
+
+    int32_t start_h = GetOctileDistance(start, target);
+    if (start_h > max_cost)
+    {
+        return false;
+    }
+
+    BeginPathSearch(pathfinder);
+
+    int w = pathfinder->w;
+    uint32_t start_index = (uint32_t)(start.y*w + start.x);
+
+    pathfinder->mode = options.mode;
+    pathfinder->max_nodes = (options.max_nodes ? options.max_nodes : UINT32_MAX);
+    pathfinder->max_cost = max_cost;
+    pathfinder->target = target;
+    pathfinder->start_index = start_index;
+    pathfinder->target_index = (uint32_t)(target.y*w + target.x);
+
+    PathTile *start_tile = &pathfinder->tiles[start_index];
+    start_tile->generation = pathfinder->generation;
+    start_tile->g = 0;
+    start_tile->parent = start_index;
+    start_tile->heap_index = PATH_NOT_IN_HEAP;
+    PushOrDecreasePathHeap(pathfinder, start_index, start_h, start_h);
+
+    return true;
+}
+
+// NOTE: Expands up to node_budget more nodes of the search set up by StartPathSearch. Stopping
+// on the budget leaves everything in place, so the search picks up where it left off next time.
+static inline PathSearchResult
+ContinuePathSearch(Pathfinder *pathfinder, uint32_t node_budget)
+{
+    int w = pathfinder->w;
+    V2i target = pathfinder->target;
+    int32_t max_cost = pathfinder->max_cost;
+
+    for (uint32_t budget_used = 0; budget_used < node_budget; ++budget_used)
+    {
+        if (!pathfinder->heap_count || (pathfinder->expanded_count >= pathfinder->max_nodes))
+        {
+            return PathSearch_NotFound;
+        }
+
+        uint32_t index = PopPathHeap(pathfinder);
+        if (index == pathfinder->target_index)
+        {
+            return PathSearch_Found;
+        }
+
+        pathfinder->expanded_count += 1;
+
+        PathTile *tile = &pathfinder->tiles[index];
+        int32_t g = tile->g;
+        V2i p = MakeV2i((int)(index % w), (int)(index / w));
+
+        if (pathfinder->mode == PathMode_AStar)
+        {
+            for (size_t move_index = 0; move_index < ArrayCount(path_moves); ++move_index)
+            {
+                V2i move = path_moves[move_index];
+                V2i next_p = p + move;
+                if (PathTileOpen(pathfinder, next_p, target))
+                {
+                    RelaxPathNode(pathfinder, index, next_p, g + GetPathStepCost(move), target, max_cost);
+                }
+            }
+        }
+        else
+        {
+            V2i parent_p = MakeV2i((int)(tile->parent % w), (int)(tile->parent / w));
+            V2i direction = GetPathDirection(parent_p, p);
+
+            V2i directions[ArrayCount(path_moves)];
+            size_t direction_count = GetJumpDirections(pathfinder, p, direction, target, directions);
+            for (size_t direction_index = 0; direction_index < direction_count; ++direction_index)
+            {
+                V2i jump_direction = directions[direction_index];
+
+                V2i jump_point;
+                bool jumped = ((jump_direction.x && jump_direction.y)
+                               ? JumpDiagonal(pathfinder, p, jump_direction, target, &jump_point)
+                               : JumpStraight(pathfinder, p, jump_direction, target, &jump_point));
+                if (jumped)
+                {
+                    RelaxPathNode(pathfinder, index, jump_point, g + GetOctileDistance(p, jump_point), target, max_cost);
+                }
+            }
+        }
+    }
+
+    return PathSearch_Running;
+}
+
+// NOTE: Returns the steps from start to target, not including the start itself. The target
+// is allowed to block pathing, so you can path to a door or a chest. Comes back empty if
+// there's no path, or none within the limits. Both modes find a shortest path, though not
+// necessarily the same one.
+static inline Path
+FindPath(Pathfinder *pathfinder, Arena *arena, V2i start, V2i target, PathOptions options = {})
+{
+    Path result = {};
+
+    if (StartPathSearch(pathfinder, start, target, options) &&
+        (ContinuePathSearch(pathfinder, UINT32_MAX) == PathSearch_Found))
+    {
+        result = ReconstructPath(pathfinder, arena, pathfinder->start_index, pathfinder->target_index);
+    }
+
+    return result;
+}
+
+// NOTE: Sums the step costs of a path, as found from start
+static inline int32_t
+GetPathCost(V2i start, Path path)
+{
+    int32_t result = 0;
+    V2i at = start;
+    for (uint32_t i = 0; i < path.length; ++i)
+    {
+        result += GetPathStepCost(path.positions[i] - at);
+        at = path.positions[i];
+    }
+    return result;
+}
+
+static inline bool
+IsRoomGraphJunction(GenTiles *tiles, V2i p)
+{
+    static const V2i directions[] =
+    {
+        MakeV2i(-1, 0), MakeV2i(1, 0), MakeV2i(0, -1), MakeV2i(0, 1),
+    };
+
+    int open_count = 0;
+    for (size_t i = 0; i < ArrayCount(directions); ++i)
+    {
+        GenTile neighbor = GetTile(tiles, p + directions[i]);
+        if ((neighbor == GenTile_Corridor) || (neighbor == GenTile_Door))
+        {
+            open_count += 1;
+        }
+    }
+    return open_count >= 3;
+}
+
+// NOTE: Nodes right next to each other have an edge of their own, they don't need one across
+// the cluster as well.
+static inline bool
+AreRoomGraphNeighbors(V2i a, V2i b)
+{
+    V2i d = a - b;
+    return (Abs(d.x) + Abs(d.y)) == 1;
+}
+
+// NOTE: The cost of the shortest path from a to b, or -1 if there isn't one
+static inline int32_t
+GetRoomGraphEdgeCost(Pathfinder *pathfinder, Arena *temp_arena, V2i a, V2i b)
+{
+    ScopedMemory temp(temp_arena);
+
+    int32_t result = -1;
+    Path path = FindPath(pathfinder, temp_arena, a, b);
+    if (path.length)
+    {
+        result = GetPathCost(a, path);
+    }
+    return result;
+}
+
+struct RoomGraphBuildEdge
+{
+    uint32_t from;
+    RoomGraphEdge edge;
+};
+
+static inline void
+BuildRoomGraph(GenTiles *tiles)
+{
+    Arena *arena = &entity_manager->arena;
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    static const V2i directions[] =
+    {
+        MakeV2i(-1, 0), MakeV2i(1, 0), MakeV2i(0, -1), MakeV2i(0, 1),
+    };
+
+    int w = tiles->w;
+    int h = tiles->h;
+    size_t tile_count = (size_t)w*h;
+
+    RoomGraph *graph = PushStruct(arena, RoomGraph);
+    graph->tile_clusters = PushArray(arena, tile_count, uint16_t);
+    graph->tile_nodes = PushArray(arena, tile_count, uint16_t);
+
+    //
+    // Nodes
+    //
+
+    graph->nodes = PushArrayNoClear(temp_arena, tile_count, RoomGraphNode);
+    for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x)
+    {
+        V2i p = MakeV2i(x, y);
+        GenTile tile = GetTile(tiles, p);
+        if ((tile == GenTile_Door) ||
+            ((tile == GenTile_Corridor) && IsRoomGraphJunction(tiles, p)))
+        {
+            if (graph->node_count >= UINT16_MAX)
+            {
+                continue;
+            }
+
+            RoomGraphNode *node = &graph->nodes[graph->node_count++];
+            ZeroStruct(node);
+            node->p = p;
+            for (Entity *e = GetEntitesOnTile(p); e; e = e->next_on_tile)
+            {
+                if (HasProperty(e, EntityProperty_Door))
+                {
+                    node->door = HandleFromEntity(e);
+                }
+            }
+            graph->tile_nodes[IndexP(tiles, p)] = (uint16_t)graph->node_count;
+        }
+    }
+
+    //
+    // Clusters, the rooms first and then each run of corridor between nodes
+    //
+
+    graph->cluster_count = 1;
+    for (int room_index = 0; room_index < tiles->room_count; ++room_index)
+    {
+        Rect2i rect = tiles->rooms[room_index].rect;
+        for (int y = rect.min.y; y < rect.max.y; ++y)
+        for (int x = rect.min.x; x < rect.max.x; ++x)
+        {
+            V2i p = MakeV2i(x, y);
+            if (GetTile(tiles, p) == GenTile_Room)
+            {
+                graph->tile_clusters[IndexP(tiles, p)] = (uint16_t)graph->cluster_count;
+            }
+        }
+        graph->cluster_count += 1;
+    }
+
+    V2i *stack = PushArrayNoClear(temp_arena, tile_count, V2i);
+    for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x)
+    {
+        V2i seed_p = MakeV2i(x, y);
+        int seed_index = IndexP(tiles, seed_p);
+        if ((GetTile(tiles, seed_p) != GenTile_Corridor) ||
+            graph->tile_nodes[seed_index] ||
+            graph->tile_clusters[seed_index] ||
+            (graph->cluster_count >= UINT16_MAX))
+        {
+            continue;
+        }
+
+        uint16_t cluster = (uint16_t)graph->cluster_count++;
+        graph->tile_clusters[seed_index] = cluster;
+
+        size_t stack_count = 0;
+        stack[stack_count++] = seed_p;
+        while (stack_count)
+        {
+            V2i p = stack[--stack_count];
+            for (size_t i = 0; i < ArrayCount(directions); ++i)
+            {
+                V2i next_p = p + directions[i];
+                if (GetTile(tiles, next_p) == GenTile_Corridor)
+                {
+                    int next_index = IndexP(tiles, next_p);
+                    if (!graph->tile_nodes[next_index] && !graph->tile_clusters[next_index])
+                    {
+                        graph->tile_clusters[next_index] = cluster;
+                        stack[stack_count++] = next_p;
+                    }
+                }
+            }
+        }
+    }
+
+    //
+    // Boundary nodes of each cluster. Nodes right next to each other get connected directly.
+    //
+
+    size_t max_build_edge_count = 8*(size_t)graph->node_count;
+    size_t build_edge_count = 0;
+    RoomGraphBuildEdge *build_edges = PushArrayNoClear(temp_arena, max_build_edge_count, RoomGraphBuildEdge);
+
+    graph->clusters = PushArray(arena, graph->cluster_count, RoomGraphCluster);
+
+    size_t boundary_count = 0;
+    uint32_t *boundary_clusters = PushArrayNoClear(temp_arena, 4*(size_t)graph->node_count, uint32_t);
+    uint32_t *boundary_nodes = PushArrayNoClear(temp_arena, 4*(size_t)graph->node_count, uint32_t);
+    for (uint32_t node_index = 0; node_index < graph->node_count; ++node_index)
+    {
+        V2i p = graph->nodes[node_index].p;
+
+        uint32_t seen_clusters[ArrayCount(directions)];
+        size_t seen_count = 0;
+        for (size_t i = 0; i < ArrayCount(directions); ++i)
+        {
+            V2i next_p = p + directions[i];
+            if (!InBounds(tiles, next_p))
+            {
+                continue;
+            }
+
+            int next_index = IndexP(tiles, next_p);
+            if (graph->tile_nodes[next_index])
+            {
+                RoomGraphBuildEdge *build_edge = &build_edges[build_edge_count++];
+                build_edge->from = node_index;
+                build_edge->edge.to = graph->tile_nodes[next_index] - 1;
+                build_edge->edge.cost = PATH_STRAIGHT_COST;
+                continue;
+            }
+
+            uint32_t cluster = graph->tile_clusters[next_index];
+            bool seen = (cluster == 0);
+            for (size_t j = 0; j < seen_count; ++j)
+            {
+                seen |= (seen_clusters[j] == cluster);
+            }
+
+            if (!seen)
+            {
+                seen_clusters[seen_count++] = cluster;
+                boundary_clusters[boundary_count] = cluster;
+                boundary_nodes[boundary_count] = node_index;
+                boundary_count += 1;
+                graph->clusters[cluster].node_count += 1;
+            }
+        }
+    }
+
+    graph->cluster_nodes = PushArrayNoClear(arena, boundary_count, uint32_t);
+    uint32_t next_cluster_node = 0;
+    for (uint32_t cluster = 0; cluster < graph->cluster_count; ++cluster)
+    {
+        graph->clusters[cluster].first_node = next_cluster_node;
+        next_cluster_node += graph->clusters[cluster].node_count;
+        graph->clusters[cluster].node_count = 0;
+    }
+    for (size_t i = 0; i < boundary_count; ++i)
+    {
+        RoomGraphCluster *cluster = &graph->clusters[boundary_clusters[i]];
+        graph->cluster_nodes[cluster->first_node + cluster->node_count++] = boundary_nodes[i];
+    }
+
+    //
+    // Edges across each cluster, costed by an actual search. They're kept even when there's no
+    // way through, so RefreshRoomGraph has somewhere to put the cost once there is.
+    //
+
+    Pathfinder *pathfinder = GetPathfinder();
+    for (uint32_t cluster_index = 1; cluster_index < graph->cluster_count; ++cluster_index)
+    {
+        RoomGraphCluster *cluster = &graph->clusters[cluster_index];
+        for (uint32_t i = 0; i < cluster->node_count; ++i)
+        for (uint32_t j = i + 1; j < cluster->node_count; ++j)
+        {
+            uint32_t a = graph->cluster_nodes[cluster->first_node + i];
+            uint32_t b = graph->cluster_nodes[cluster->first_node + j];
+            if (AreRoomGraphNeighbors(graph->nodes[a].p, graph->nodes[b].p))
+            {
+                continue;
+            }
+
+            if (build_edge_count + 2 > max_build_edge_count)
+            {
+                // NOTE: Rooms with lots of doors can go past the initial guess, the edges
+                // built so far are safe at the bottom of temp_arena.
+                RoomGraphBuildEdge *grown = PushArrayNoClear(temp_arena, 2*max_build_edge_count, RoomGraphBuildEdge);
+                CopyArray(build_edge_count, build_edges, grown);
+                build_edges = grown;
+                max_build_edge_count *= 2;
+            }
+
+            int32_t cost = GetRoomGraphEdgeCost(pathfinder, temp_arena, graph->nodes[a].p, graph->nodes[b].p);
+            build_edges[build_edge_count++] = { a, { b, cost } };
+            build_edges[build_edge_count++] = { b, { a, cost } };
+        }
+    }
+
+    //
+    // Sort the edges by the node they come from
+    //
+
+    for (size_t i = 0; i < build_edge_count; ++i)
+    {
+        graph->nodes[build_edges[i].from].edge_count += 1;
+    }
+
+    graph->edge_count = 0;
+    for (uint32_t node_index = 0; node_index < graph->node_count; ++node_index)
+    {
+        RoomGraphNode *node = &graph->nodes[node_index];
+        node->first_edge = graph->edge_count;
+        graph->edge_count += node->edge_count;
+        node->edge_count = 0;
+    }
+
+    graph->edges = PushArrayNoClear(arena, graph->edge_count, RoomGraphEdge);
+    for (size_t i = 0; i < build_edge_count; ++i)
+    {
+        RoomGraphNode *node = &graph->nodes[build_edges[i].from];
+        graph->edges[node->first_edge + node->edge_count++] = build_edges[i].edge;
+    }
+
+    RoomGraphNode *nodes = PushArrayNoClear(arena, graph->node_count, RoomGraphNode);
+    CopyArray(graph->node_count, graph->nodes, nodes);
+    graph->nodes = nodes;
+
+    entity_manager->room_graph = graph;
+}
+
+// NOTE: Whether the traveller can get through the door, if it comes to that. Unlocked doors
+// just need a bump, locked ones without a key unlock on a bump too (see TryOpen), and the rest
+// need the key in the traveller's inventory.
+static inline bool
+CanPassDoor(EntityHandle door_handle, Entity *traveller)
+{
+    Entity *door = EntityFromHandle(door_handle);
+    if (!door || !door->locked || (door->required_key == NullEntityHandle()))
+    {
+        return true;
+    }
+
+    bool result = false;
+    if (traveller)
+    {
+        for (EntityListIter iter = IterateList(&traveller->inventory); IsValid(iter); Next(&iter))
+        {
+            if (HandleFromEntity(iter.entity) == door->required_key)
+            {
+                result = true;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static inline uint32_t
+GetRoomGraphNodeAt(RoomGraph *graph, V2i p)
+{
+    return graph->tile_nodes[p.y*entity_manager->world_w + p.x];
+}
+
+static inline uint32_t
+GetRoomGraphClusterAt(RoomGraph *graph, V2i p)
+{
+    return graph->tile_clusters[p.y*entity_manager->world_w + p.x];
+}
+
+// NOTE: Called by UpdateTileBlocking. Node tiles don't need anything, the edges end on them and
+// searches can always step onto their target. A change outside the cluster can still make a
+// path across it longer or shorter, but only by going around, which the graph covers already.
+static inline void
+MarkRoomGraphTileChanged(V2i p)
+{
+    RoomGraph *graph = entity_manager->room_graph;
+    if (graph)
+    {
+        uint32_t cluster_index = GetRoomGraphClusterAt(graph, p);
+        RoomGraphCluster *cluster = &graph->clusters[cluster_index];
+        if (cluster_index && !cluster->dirty)
+        {
+            cluster->dirty = true;
+            graph->dirty_cluster_count += 1;
+        }
+    }
+}
+
+static inline RoomGraphEdge *
+FindRoomGraphEdge(RoomGraph *graph, uint32_t from, uint32_t to)
+{
+    RoomGraphEdge *result = nullptr;
+
+    RoomGraphNode *node = &graph->nodes[from];
+    for (uint32_t i = 0; i < node->edge_count; ++i)
+    {
+        RoomGraphEdge *edge = &graph->edges[node->first_edge + i];
+        if (edge->to == to)
+        {
+            result = edge;
+            break;
+        }
+    }
+    return result;
+}
+
+// NOTE: Searches the edges across dirty clusters again. Uses GetPathfinder, so main thread only.
+static inline void
+RefreshRoomGraph(RoomGraph *graph)
+{
+    if (!graph->dirty_cluster_count)
+    {
+        return;
+    }
+
+    ProfileScope();
+
+    Arena *temp_arena = platform->GetTempArena();
+    Pathfinder *pathfinder = GetPathfinder();
+
+    for (uint32_t cluster_index = 1; cluster_index < graph->cluster_count; ++cluster_index)
+    {
+        RoomGraphCluster *cluster = &graph->clusters[cluster_index];
+        if (!cluster->dirty)
+        {
+            continue;
+        }
+        cluster->dirty = false;
+
+        for (uint32_t i = 0; i < cluster->node_count; ++i)
+        for (uint32_t j = i + 1; j < cluster->node_count; ++j)
+        {
+            uint32_t a = graph->cluster_nodes[cluster->first_node + i];
+            uint32_t b = graph->cluster_nodes[cluster->first_node + j];
+            if (AreRoomGraphNeighbors(graph->nodes[a].p, graph->nodes[b].p))
+            {
+                continue;
+            }
+
+            RoomGraphEdge *a_to_b = FindRoomGraphEdge(graph, a, b);
+            RoomGraphEdge *b_to_a = FindRoomGraphEdge(graph, b, a);
+            Assert(a_to_b && b_to_a);
+
+            int32_t cost = GetRoomGraphEdgeCost(pathfinder, temp_arena, graph->nodes[a].p, graph->nodes[b].p);
+            a_to_b->cost = cost;
+            b_to_a->cost = cost;
+        }
+
+        ProfileCounter("Room graph clusters refreshed");
+    }
+
+    graph->dirty_cluster_count = 0;
+}
+
+// NOTE: The room graph search uses a plain binary heap with lazy deletion, stale entries get
+// skipped when they're popped. The graph is small enough that it doesn't need decrease-key.
+static inline void
+PushRoomGraphHeap(Pathfinder *pathfinder, PathHeapEntry entry)
+{
+    Assert(pathfinder->graph_heap_count < pathfinder->graph_heap_capacity);
+
+    PathHeapEntry *heap = pathfinder->graph_heap;
+    size_t at = pathfinder->graph_heap_count++;
+    heap[at] = entry;
+    while (at > 0)
+    {
+        size_t parent = (at - 1) / 2;
+        if (!PathHeapLess(heap[at], heap[parent]))
+        {
+            break;
+        }
+        Swap(heap[at], heap[parent]);
+        at = parent;
+    }
+}
+
+static inline PathHeapEntry
+PopRoomGraphHeap(Pathfinder *pathfinder)
+{
+    Assert(pathfinder->graph_heap_count > 0);
+
+    PathHeapEntry *heap = pathfinder->graph_heap;
+    PathHeapEntry result = heap[0];
+
+    size_t count = --pathfinder->graph_heap_count;
+    heap[0] = heap[count];
+    for (size_t at = 0;;)
+    {
+        size_t child = 2*at + 1;
+        if (child >= count)
+        {
+            break;
+        }
+        if ((child + 1 < count) && PathHeapLess(heap[child + 1], heap[child]))
+        {
+            child += 1;
+        }
+        if (!PathHeapLess(heap[child], heap[at]))
+        {
+            break;
+        }
+        Swap(heap[at], heap[child]);
+        at = child;
+    }
+
+    return result;
+}
+
+// NOTE: Search state for the node, reset if it's from an older search
+static inline RoomGraphSearchNode *
+GetRoomGraphSearchNode(Pathfinder *pathfinder, uint32_t index)
+{
+    RoomGraphSearchNode *result = &pathfinder->graph_nodes[index];
+    if (result->generation != pathfinder->graph_generation)
+    {
+        result->generation = pathfinder->graph_generation;
+        result->g = INT32_MAX;
+        result->target_cost = -1;
+        result->closed = false;
+    }
+    return result;
+}
+
+static inline void
+BeginRoomGraphSearch(Pathfinder *pathfinder, RoomGraph *graph)
+{
+    // NOTE: Two more than the graph has nodes, for the start and target
+    uint32_t node_count = graph->node_count + 2;
+    size_t heap_capacity = graph->edge_count + 2*(size_t)node_count;
+    if ((pathfinder->graph_node_capacity < node_count) ||
+        (pathfinder->graph_heap_capacity < heap_capacity))
+    {
+        pathfinder->graph_node_capacity = node_count;
+        pathfinder->graph_nodes = PushArray(pathfinder->arena, node_count, RoomGraphSearchNode);
+        pathfinder->graph_heap_capacity = heap_capacity;
+        pathfinder->graph_heap = PushArrayNoClear(pathfinder->arena, heap_capacity, PathHeapEntry);
+        pathfinder->graph_generation = 0;
+    }
+
+    pathfinder->graph_generation += 1;
+    if (pathfinder->graph_generation == 0)
+    {
+        for (uint32_t i = 0; i < pathfinder->graph_node_capacity; ++i)
+        {
+            pathfinder->graph_nodes[i].generation = 0;
+        }
+        pathfinder->graph_generation = 1;
+    }
+
+    pathfinder->graph_heap_count = 0;
+}
+
+// NOTE: Runs A* on the room graph, with the start and target hooked up as two extra nodes.
+// Returns the number of waypoints written, or 0 if there's no way through.
+static inline uint32_t
+PlanOnRoomGraph(Pathfinder *pathfinder, RoomGraph *graph, V2i start, V2i target, Entity *traveller,
+                uint32_t start_node, uint32_t start_cluster, uint32_t target_node, uint32_t target_cluster)
+{
+    uint32_t node_count = graph->node_count;
+    uint32_t start_index = node_count;
+    uint32_t target_index = node_count + 1;
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    // NOTE: The start doesn't have edges of its own, it goes to its node or to every node on
+    // the boundary of its cluster.
+    uint32_t start_edge_count = 0;
+    RoomGraphEdge *start_edges = nullptr;
+    if (start_node)
+    {
+        start_edges = PushArrayNoClear(temp_arena, 1, RoomGraphEdge);
+        start_edges[start_edge_count++] = { start_node - 1, 0 };
+    }
+    else
+    {
+        RoomGraphCluster *cluster = &graph->clusters[start_cluster];
+        start_edges = PushArrayNoClear(temp_arena, cluster->node_count, RoomGraphEdge);
+        for (uint32_t i = 0; i < cluster->node_count; ++i)
+        {
+            uint32_t node = graph->cluster_nodes[cluster->first_node + i];
+            start_edges[start_edge_count++] = { node, GetOctileDistance(start, graph->nodes[node].p) };
+        }
+    }
+
+    BeginRoomGraphSearch(pathfinder, graph);
+
+    if (target_node)
+    {
+        GetRoomGraphSearchNode(pathfinder, target_node - 1)->target_cost = 0;
+    }
+    else
+    {
+        RoomGraphCluster *cluster = &graph->clusters[target_cluster];
+        for (uint32_t i = 0; i < cluster->node_count; ++i)
+        {
+            uint32_t node = graph->cluster_nodes[cluster->first_node + i];
+            GetRoomGraphSearchNode(pathfinder, node)->target_cost = GetOctileDistance(graph->nodes[node].p, target);
+        }
+    }
+
+    int32_t start_h = GetOctileDistance(start, target);
+    GetRoomGraphSearchNode(pathfinder, start_index)->g = 0;
+    PushRoomGraphHeap(pathfinder, { start_h, start_h, start_index });
+
+    bool found = false;
+    while (pathfinder->graph_heap_count)
+    {
+        uint32_t index = PopRoomGraphHeap(pathfinder).tile_index;
+        RoomGraphSearchNode *search_node = GetRoomGraphSearchNode(pathfinder, index);
+        if (search_node->closed)
+        {
+            continue;
+        }
+        search_node->closed = true;
+
+        if (index == target_index)
+        {
+            found = true;
+            break;
+        }
+
+        uint32_t edge_count = start_edge_count;
+        RoomGraphEdge *edges = start_edges;
+        if (index != start_index)
+        {
+            RoomGraphNode *node = &graph->nodes[index];
+            edge_count = node->edge_count;
+            edges = &graph->edges[node->first_edge];
+        }
+
+        RoomGraphEdge target_edge = { target_index, search_node->target_cost };
+        for (uint32_t i = 0; i <= edge_count; ++i)
+        {
+            RoomGraphEdge edge;
+            if (i < edge_count)
+            {
+                edge = edges[i];
+            }
+            else if (target_edge.cost >= 0)
+            {
+                edge = target_edge;
+            }
+            else
+            {
+                break;
+            }
+
+            if (edge.cost < 0)
+            {
+                continue;
+            }
+
+            RoomGraphSearchNode *next = GetRoomGraphSearchNode(pathfinder, edge.to);
+            if (next->closed)
+            {
+                continue;
+            }
+
+            // NOTE: You can always walk up to a door, it's getting through that takes a key
+            if ((edge.to < node_count) &&
+                (edge.to + 1 != target_node) &&
+                !CanPassDoor(graph->nodes[edge.to].door, traveller))
+            {
+                continue;
+            }
+
+            int32_t next_g = search_node->g + edge.cost;
+            if (next_g < next->g)
+            {
+                next->g = next_g;
+                next->parent = index;
+
+                V2i p = (edge.to < node_count ? graph->nodes[edge.to].p : target);
+                int32_t h = GetOctileDistance(p, target);
+                PushRoomGraphHeap(pathfinder, { next_g + h, h, edge.to });
+            }
+        }
+    }
+
+    uint32_t result = 0;
+    if (found)
+    {
+        for (uint32_t index = target_index; index != start_index; index = pathfinder->graph_nodes[index].parent)
+        {
+            result += 1;
+        }
+    }
+    return result;
+}
+
+// NOTE: Plans from start to target on the room graph, and gives back the waypoints without a
+// leg. Start and target get hooked up to the boundary of the cluster they're in, with the
+// octile distance standing in for the actual cost, so the plan is close to but not always
+// exactly the shortest. Within one cluster, or without a graph to plan on, the only waypoint
+// is the target. No waypoints at all means there's no way through. Main thread only, since it
+// looks at doors and may need to refresh the graph.
+static inline RoomGraphPath
+PlanRoomGraphPath(Pathfinder *pathfinder, Arena *arena, V2i start, V2i target, Entity *traveller)
+{
+    RoomGraphPath result = {};
+
+    if (!IsInWorld(start) || !IsInWorld(target) || AreEqual(start, target))
+    {
+        return result;
+    }
+
+    RoomGraph *graph = entity_manager->room_graph;
+    if (graph)
+    {
+        RefreshRoomGraph(graph);
+    }
+
+    uint32_t start_node = (graph ? GetRoomGraphNodeAt(graph, start) : 0);
+    uint32_t target_node = (graph ? GetRoomGraphNodeAt(graph, target) : 0);
+    uint32_t start_cluster = (graph ? GetRoomGraphClusterAt(graph, start) : 0);
+    uint32_t target_cluster = (graph ? GetRoomGraphClusterAt(graph, target) : 0);
+
+    uint32_t waypoint_count = 0;
+    if (graph &&
+        (start_node || start_cluster) &&
+        (target_node || target_cluster) &&
+        !(start_cluster && (start_cluster == target_cluster)))
+    {
+        waypoint_count = PlanOnRoomGraph(pathfinder, graph, start, target, traveller,
+                                         start_node, start_cluster, target_node, target_cluster);
+        if (!waypoint_count)
+        {
+            return result;
+        }
+    }
+
+    if (waypoint_count)
+    {
+        V2i *waypoints = PushArrayNoClear(arena, waypoint_count, V2i);
+
+        uint32_t node_count = graph->node_count;
+        uint32_t i = waypoint_count;
+        for (uint32_t index = node_count + 1; index != node_count; index = pathfinder->graph_nodes[index].parent)
+        {
+            waypoints[--i] = (index < node_count ? graph->nodes[index].p : target);
+        }
+
+        // NOTE: Starting out on a node gives a first waypoint that's already been reached
+        if (AreEqual(waypoints[0], start))
+        {
+            waypoints += 1;
+            waypoint_count -= 1;
+        }
+
+        result.waypoint_count = waypoint_count;
+        result.waypoints = waypoints;
+    }
+    else
+    {
+        result.waypoint_count = 1;
+        result.waypoints = PushArrayNoClear(arena, 1, V2i);
+        result.waypoints[0] = target;
+    }
+
+    return result;
+}
+
+// NOTE: PlanRoomGraphPath, then the tile path for just the first leg
+static inline RoomGraphPath
+FindRoomGraphPath(Pathfinder *pathfinder, Arena *arena, V2i start, V2i target, Entity *traveller, PathOptions options = {})
+{
+    RoomGraphPath result = PlanRoomGraphPath(pathfinder, arena, start, target, traveller);
+    if (result.waypoint_count)
+    {
+        result.leg = FindPath(pathfinder, arena, start, result.waypoints[0], options);
+        result.found = (result.leg.length > 0);
+    }
+    return result;
+}
+
+static inline void
+CopyPathingSnapshot(PathRequests *requests)
+{
+    TileBitplane *snapshot = &requests->snapshot;
+    CopyArray((size_t)snapshot->words_per_row*entity_manager->world_h,
+              entity_manager->block_pathing.words, snapshot->words);
+    requests->snapshot_version = entity_manager->pathing_version;
+}
+
+static inline PathRequests *
+GetPathRequests(void)
+{
+    if (!entity_manager->path_requests)
+    {
+        PathRequests *requests = PushStruct(&entity_manager->arena, PathRequests);
+        InitializePathfinder(&requests->pathfinder, &entity_manager->arena, entity_manager->world_w, entity_manager->world_h);
+        InitializeBitplane(&requests->snapshot, entity_manager->world_w, entity_manager->world_h);
+        requests->pathfinder.block_pathing = &requests->snapshot;
+        CopyPathingSnapshot(requests);
+
+        entity_manager->path_requests = requests;
+    }
+    return entity_manager->path_requests;
+}
+
+static inline PathRequest *
+GetPathRequest(PathRequests *requests, PathTicket ticket)
+{
+    PathRequest *result = nullptr;
+    if (ticket.index < MAX_PATH_REQUESTS)
+    {
+        PathRequest *request = &requests->requests[ticket.index];
+        if ((request->generation == ticket.generation) &&
+            (request->status != PathRequest_Invalid) &&
+            !request->released)
+        {
+            result = request;
+        }
+    }
+    return result;
+}
+
+// NOTE: Where the job should search to for a request from start to goal. Goals that are far
+// enough out get planned on the room graph here on the main thread, which is cheap next to the
+// tile search, and the search goes to the furthest waypoint that's still in range, or the first
+// one if none are. Returns false if the plan says there's no way through.
+static inline bool
+GetPathRequestSearchGoal(V2i start, V2i goal, PathOptions options, Entity *traveller, V2i *search_goal)
+{
+    *search_goal = goal;
+
+    int32_t distance = GetOctileDistance(start, goal);
+    int32_t max_leg_distance = PATH_STRAIGHT_COST*PATH_REQUEST_ROOM_GRAPH_DISTANCE;
+    if ((distance <= max_leg_distance) ||
+        (options.max_distance && (distance > PATH_STRAIGHT_COST*options.max_distance)))
+    {
+        return true;
+    }
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    RoomGraphPath plan = PlanRoomGraphPath(GetPathfinder(), temp_arena, start, goal, traveller);
+    if (!plan.waypoint_count)
+    {
+        return false;
+    }
+
+    *search_goal = plan.waypoints[0];
+    for (uint32_t i = 1; i < plan.waypoint_count; ++i)
+    {
+        if (GetOctileDistance(start, plan.waypoints[i]) > max_leg_distance)
+        {
+            break;
+        }
+        *search_goal = plan.waypoints[i];
+    }
+
+    ProfileCounter("Path requests planned on the room graph");
+    return true;
+}
+
+// NOTE: Queues up a search from start to goal, to be picked up by the next job. The traveller
+// is for the room graph, to know which locked doors it can get through. Returns the null
+// ticket if all the requests are taken.
+static inline PathTicket
+RequestPath(V2i start, V2i goal, PathOptions options = {}, Entity *traveller = nullptr)
+{
+    PathTicket result = {};
+
+    PathRequests *requests = GetPathRequests();
+    for (uint32_t index = 0; index < MAX_PATH_REQUESTS; ++index)
+    {
+        PathRequest *request = &requests->requests[index];
+        if (request->status == PathRequest_Invalid)
+        {
+            request->generation += 1;
+            if (request->generation == 0)
+            {
+                request->generation = 1;
+            }
+
+            request->status = PathRequest_Pending;
+            request->start = start;
+            request->goal = goal;
+            request->options = options;
+
+            ProfileCounter("Path requests submitted");
+            if (GetPathRequestSearchGoal(start, goal, options, traveller, &request->search_goal))
+            {
+                requests->queue[requests->queue_count++] = index;
+            }
+            else
+            {
+                request->status = PathRequest_NotFound;
+            }
+
+            result.index = index;
+            result.generation = request->generation;
+            break;
+        }
+    }
+
+    return result;
+}
+
+static inline PathRequestResult
+PollPathRequest(PathTicket ticket)
+{
+    PathRequestResult result = {};
+
+    PathRequest *request = (entity_manager->path_requests ? GetPathRequest(entity_manager->path_requests, ticket) : nullptr);
+    if (request)
+    {
+        result.status = request->status;
+        result.start = request->start;
+        result.goal = request->goal;
+        if (request->status == PathRequest_Found)
+        {
+            result.pathing_version = request->pathing_version;
+            result.path.length = request->length;
+            result.path.positions = request->positions;
+        }
+    }
+
+    return result;
+}
+
+// NOTE: Done with the ticket, whether the search finished or not. Pending requests can't be
+// pulled out from under a running job, so they get freed by the next UpdatePathRequests.
+static inline void
+ReleasePathRequest(PathTicket ticket)
+{
+    PathRequest *request = (entity_manager->path_requests ? GetPathRequest(entity_manager->path_requests, ticket) : nullptr);
+    if (request)
+    {
+        if (request->status == PathRequest_Pending)
+        {
+            request->released = true;
+        }
+        else
+        {
+            request->status = PathRequest_Invalid;
+        }
+    }
+}
+
+static
+PLATFORM_JOB(PathRequestJob)
+{
+    PathRequests *requests = (PathRequests *)args;
+    Pathfinder *pathfinder = &requests->pathfinder;
+
+    Arena *temp_arena = platform->GetTempArena();
+
+    uint32_t node_budget = PATH_REQUEST_NODE_BUDGET;
+    for (uint32_t batch_index = 0; (batch_index < requests->batch_count) && node_budget; ++batch_index)
+    {
+        PathTicket ticket = requests->batch[batch_index];
+        PathRequest *request = &requests->requests[ticket.index];
+
+        PathSearchResult search = PathSearch_NotFound;
+        if ((requests->searching == ticket) ||
+            StartPathSearch(pathfinder, request->start, request->search_goal, request->options))
+        {
+            requests->searching = ticket;
+
+            uint32_t expanded_before = pathfinder->expanded_count;
+            search = ContinuePathSearch(pathfinder, node_budget);
+
+            uint32_t expanded = pathfinder->expanded_count - expanded_before;
+            node_budget -= (expanded < node_budget ? expanded : node_budget);
+        }
+
+        if (search == PathSearch_Running)
+        {
+            break;
+        }
+
+        request->found = (search == PathSearch_Found);
+        request->pathing_version = requests->snapshot_version;
+        request->length = 0;
+        if (request->found)
+        {
+            ScopedMemory temp(temp_arena);
+
+            Path path = ReconstructPath(pathfinder, temp_arena, pathfinder->start_index, pathfinder->target_index);
+            request->length = (path.length < PATH_REQUEST_MAX_LENGTH ? path.length : PATH_REQUEST_MAX_LENGTH);
+            CopyArray(request->length, path.positions, request->positions);
+        }
+
+        requests->searching = {};
+        requests->done_count += 1;
+    }
+
+    AtomicExchange(&requests->job_running, 0);
+}
+
+// NOTE: Call once a frame. Hands out what the last job found and starts the next one on
+// whatever's pending, unless the last one is still running, in which case it'll get another
+// shot next frame. Never waits on the job.
+static inline void
+UpdatePathRequests(void)
+{
+    PathRequests *requests = entity_manager->path_requests;
+    if (!requests || AtomicLoad(&requests->job_running))
+    {
+        return;
+    }
+
+    ProfileScope();
+
+    for (uint32_t batch_index = 0; batch_index < requests->batch_count; ++batch_index)
+    {
+        PathRequest *request = &requests->requests[requests->batch[batch_index].index];
+        request->in_job = false;
+        if (batch_index < requests->done_count)
+        {
+            request->status = (request->found ? PathRequest_Found : PathRequest_NotFound);
+            ProfileCounter("Path requests completed");
+        }
+    }
+    requests->batch_count = 0;
+    requests->done_count = 0;
+
+    uint32_t queue_count = 0;
+    for (uint32_t queue_index = 0; queue_index < requests->queue_count; ++queue_index)
+    {
+        uint32_t index = requests->queue[queue_index];
+        PathRequest *request = &requests->requests[index];
+        if (request->released)
+        {
+            request->status = PathRequest_Invalid;
+            request->released = false;
+        }
+        if (request->status == PathRequest_Pending)
+        {
+            requests->queue[queue_count++] = index;
+        }
+    }
+    requests->queue_count = queue_count;
+
+    // NOTE: A search that ran out of budget is always at the front of the queue, unless it got
+    // released. Never swap the snapshot out from under one that's still going.
+    if (!GetPathRequest(requests, requests->searching))
+    {
+        requests->searching = {};
+    }
+    if (!requests->searching.generation &&
+        (requests->snapshot_version != entity_manager->pathing_version))
+    {
+        CopyPathingSnapshot(requests);
+    }
+
+    if (requests->queue_count)
+    {
+        requests->batch_count = requests->queue_count;
+        for (uint32_t queue_index = 0; queue_index < requests->queue_count; ++queue_index)
+        {
+            uint32_t index = requests->queue[queue_index];
+            PathRequest *request = &requests->requests[index];
+            request->in_job = true;
+
+            requests->batch[queue_index].index = index;
+            requests->batch[queue_index].generation = request->generation;
+        }
+
+        requests->job_running = 1;
+        platform->AddJob(platform->low_priority_queue, requests, PathRequestJob);
+    }
+}
+
+static inline PathCache *
+GetPathCache(void)
+{
+    if (!entity_manager->path_cache)
+    {
+        entity_manager->path_cache = PushStruct(&entity_manager->arena, PathCache);
+    }
+    return entity_manager->path_cache;
+}
+
+static inline bool
+IsPathCacheEntryValid(PathCacheEntry *entry)
+{
+    for (uint32_t i = 0; i < entry->chunk_count; ++i)
+    {
+        if (entry->pathing_version < entity_manager->chunk_pathing_versions[entry->chunks[i]])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: Stores as much of the path as fits, stopping early if it'd go through more chunks than
+// the entry can keep track of.
+static inline void
+StorePathCacheEntry(PathCacheEntry *entry, V2i start, V2i goal, Path path, uint32_t pathing_version)
+{
+    entry->start = start;
+    entry->goal = goal;
+    entry->pathing_version = pathing_version;
+    entry->cursor = 0;
+    entry->length = 0;
+    entry->chunk_count = 0;
+
+    for (uint32_t i = 0; (i < path.length) && (i < PATH_CACHE_MAX_LENGTH); ++i)
+    {
+        V2i p = path.positions[i];
+        uint32_t chunk_index = (uint32_t)((p.y >> ENTITY_CHUNK_SIZE_LOG2)*entity_manager->chunk_count_x +
+                                          (p.x >> ENTITY_CHUNK_SIZE_LOG2));
+
+        bool seen = false;
+        for (uint32_t j = 0; j < entry->chunk_count; ++j)
+        {
+            seen |= (entry->chunks[j] == chunk_index);
+        }
+        if (!seen)
+        {
+            if (entry->chunk_count == PATH_CACHE_MAX_CHUNKS)
+            {
+                break;
+            }
+            entry->chunks[entry->chunk_count++] = chunk_index;
+        }
+
+        entry->positions[entry->length++] = p;
+    }
+}
+
+// NOTE: Picks up the path the entry asked for if the search is done. The entity may have moved
+// along the old path in the meantime, so it carries on from wherever it is on the new one.
+static inline void
+CollectPathCacheRequest(PathCache *cache, PathCacheEntry *entry, V2i p)
+{
+    PathRequestResult result = PollPathRequest(entry->ticket);
+    if (result.status == PathRequest_Pending)
+    {
+        return;
+    }
+    cache->collected_count += 1;
+
+    if (result.status == PathRequest_Found)
+    {
+        StorePathCacheEntry(entry, result.start, result.goal, result.path, result.pathing_version);
+        for (uint32_t i = 0; i < entry->length; ++i)
+        {
+            if (AreEqual(p, entry->positions[i]))
+            {
+                entry->cursor = i + 1;
+                break;
+            }
+        }
+    }
+    else
+    {
+        // NOTE: No way through, so whatever was being followed is no good either
+        entry->cursor = 0;
+        entry->length = 0;
+    }
+
+    ReleasePathRequest(entry->ticket);
+    entry->ticket = {};
+}
+
+// NOTE: The owner's entry in its set, or a new one in place of an entry nobody's using. Entries
+// with a request out are only ever given up when their owner is gone. Returns null if the whole
+// set is waiting on requests.
+static inline PathCacheEntry *
+FindPathCacheEntry(PathCache *cache, EntityHandle owner)
+{
+    PathCacheEntry *set = &cache->entries[PATH_CACHE_WAYS*(owner.index % (PATH_CACHE_SIZE / PATH_CACHE_WAYS))];
+
+    PathCacheEntry *victim = nullptr;
+    bool victim_owner_gone = false;
+    for (uint32_t way = 0; way < PATH_CACHE_WAYS; ++way)
+    {
+        PathCacheEntry *entry = &set[way];
+        if (entry->owner == owner)
+        {
+            return entry;
+        }
+
+        bool owner_gone = !EntityFromHandle(entry->owner);
+        if (!owner_gone && entry->ticket.generation)
+        {
+            continue;
+        }
+
+        // NOTE: Free and abandoned entries first, then the one that's gone unused the longest
+        if (!victim ||
+            (owner_gone && !victim_owner_gone) ||
+            ((owner_gone == victim_owner_gone) && (entry->last_used_round < victim->last_used_round)))
+        {
+            victim = entry;
+            victim_owner_gone = owner_gone;
+        }
+    }
+
+    if (victim)
+    {
+        if (victim->ticket.generation)
+        {
+            ReleasePathRequest(victim->ticket);
+            cache->dropped_count += 1;
+        }
+        ZeroStruct(victim);
+        victim->owner = owner;
+    }
+    return victim;
+}
+
+// NOTE: Gives the next step for e on its way to goal, following the cached path if it's still
+// good. If it's not a new path gets requested, and until it comes back the entity sticks to
+// the old one as long as it's still on it. Returns false if there's nothing to follow, or if
+// something's standing on the next step.
+static inline bool
+GetCachedPathStep(Entity *e, V2i goal, V2i *step)
+{
+    PathCache *cache = GetPathCache();
+
+    EntityHandle handle = HandleFromEntity(e);
+    V2i p = PositionOf(e);
+
+    PathCacheEntry *entry = FindPathCacheEntry(cache, handle);
+    if (!entry)
+    {
+        ProfileCounter("Path cache full");
+        cache->full_count += 1;
+        return false;
+    }
+    entry->last_used_round = entity_manager->schedule_round;
+
+    if (entry->ticket.generation)
+    {
+        CollectPathCacheRequest(cache, entry, p);
+    }
+
+    // NOTE: The step handed out last time only counts as taken once the entity is on it
+    if ((entry->cursor < entry->length) && AreEqual(p, entry->positions[entry->cursor]))
+    {
+        entry->cursor += 1;
+    }
+
+    V2i expected_p = (entry->cursor ? entry->positions[entry->cursor - 1] : entry->start);
+    bool on_path = (AreEqual(p, expected_p) && (entry->cursor < entry->length));
+
+    V2i goal_delta = goal - entry->goal;
+    bool hit = (on_path &&
+                (Abs(goal_delta.x) <= 1) && (Abs(goal_delta.y) <= 1) &&
+                IsPathCacheEntryValid(entry));
+
+    // NOTE: Paths from far away stop at a room graph waypoint, or wherever they got cut short.
+    // The rest gets asked for a few steps before the end, so there's no wait once it's reached.
+    bool running_out = (hit &&
+                        (entry->length - entry->cursor <= PATH_CACHE_REFILL_DISTANCE) &&
+                        !AreEqual(entry->positions[entry->length - 1], entry->goal));
+
+    if ((!hit || running_out) && !entry->ticket.generation)
+    {
+        PathOptions options = {};
+        options.max_distance = 4*AI_ENGAGEMENT_RADIUS;
+        entry->ticket = RequestPath(p, goal, options, e);
+        cache->requested_count += !!entry->ticket.generation;
+    }
+
+    if (hit)
+    {
+        ProfileCounter("Path cache hit");
+    }
+    else
+    {
+        ProfileCounter("Path cache miss");
+        if (!on_path)
+        {
+            return false;
+        }
+    }
+
+    V2i next_p = entry->positions[entry->cursor];
+    if (TileBlocked(next_p))
+    {
+        return false;
+    }
+
+    *step = next_p;
+    return true;
+}
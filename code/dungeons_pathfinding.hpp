@@ -0,0 +1,331 @@
+#ifndef DUNGEONS_PATHFINDING_HPP
+#define DUNGEONS_PATHFINDING_HPP
+
+//
+// NOTE: Point to point pathfinding, A* or jump point search over the tiles that don't block
+// pathing. Costs match the Dijkstra maps: straight steps cost 2 and diagonal ones 3, and the
+// heuristic is the octile distance in the same units, so it never overestimates.
+//
+// All the per-tile search state lives in one flat array indexed by tile. Instead of being
+// cleared between searches, every tile is stamped with the search generation that last
+// touched it, and anything with an older stamp counts as unvisited.
+//
+
+#define PATH_STRAIGHT_COST 2
+#define PATH_DIAGONAL_COST 3
+#define PATH_NOT_IN_HEAP UINT32_MAX
+
+struct Path
+{
+    uint32_t length;
+    V2i *positions;
+};
+
+enum PathMode
+{
+    PathMode_JumpPoint, // NOTE: The default, A* is still around for comparison and as a fallback
+    PathMode_AStar,
+};
+
+// NOTE: For the limits zero means no limit. max_distance is in tiles, as in straight steps,
+// and prunes anything whose cost estimate goes past it. For jump point search max_nodes
+// counts jump points, not every tile scanned on the way to them.
+struct PathOptions
+{
+    PathMode mode;
+    uint32_t max_nodes;
+    int32_t max_distance;
+};
+
+enum PathSearchResult
+{
+    PathSearch_Running, // NOTE: Ran out of budget, call ContinuePathSearch again
+    PathSearch_Found,
+    PathSearch_NotFound,
+};
+
+struct PathTile
+{
+    uint32_t generation;
+    int32_t g;
+    uint32_t parent;
+    uint32_t heap_index; // NOTE: PATH_NOT_IN_HEAP once closed
+};
+
+struct PathHeapEntry
+{
+    int32_t f;
+    int32_t h;
+    uint32_t tile_index;
+};
+
+struct RoomGraphSearchNode
+{
+    uint32_t generation;
+    int32_t g;
+    uint32_t parent;
+    int32_t target_cost; // NOTE: -1 unless the target is reachable straight from here
+    bool closed;
+};
+
+struct Pathfinder
+{
+    Arena *arena;
+
+    int w, h;
+    TileBitplane *block_pathing; // NOTE: What the searches plan around, the live one by default
+
+    uint32_t generation;
+    PathTile *tiles;
+
+    uint32_t heap_count;
+    PathHeapEntry *heap;
+
+    // NOTE: The search in progress, see StartPathSearch
+    PathMode mode;
+    uint32_t max_nodes;
+    int32_t max_cost;
+    V2i target;
+    uint32_t start_index;
+    uint32_t target_index;
+
+    // NOTE: Stats for the last search
+    uint32_t expanded_count;
+
+    // NOTE: Room graph searches, these grow to fit the graph on first use
+    uint32_t graph_generation;
+    uint32_t graph_node_capacity;
+    RoomGraphSearchNode *graph_nodes;
+
+    size_t graph_heap_count;
+    size_t graph_heap_capacity;
+    PathHeapEntry *graph_heap;
+};
+
+//
+// NOTE: The room graph is the hierarchical layer on top, built at worldgen time. Its nodes
+// are the door tiles and corridor junctions, and they split the walkable tiles into clusters:
+// the rooms, and the stretches of corridor in between junctions. Every node is connected to
+// every other node on the boundary of a cluster it touches, with the cost of the shortest path
+// between them. Long paths get planned on the graph first, and only the leg up to the first
+// waypoint gets searched tile by tile.
+//
+// Door nodes remember their door, and edges into them only count if whoever's travelling can
+// get through it: unlocked doors are fine, locked ones need the right key.
+//
+// When a tile in a cluster starts or stops blocking pathing, UpdateTileBlocking marks the
+// cluster dirty, and the costs of the edges across it get searched again before the next plan.
+// Edges stay in place when the way between their nodes gets cut off, with a cost of -1.
+//
+
+struct RoomGraphEdge
+{
+    uint32_t to;
+    int32_t cost; // NOTE: -1 if there's currently no way through
+};
+
+struct RoomGraphNode
+{
+    V2i p;
+    EntityHandle door;
+
+    uint32_t first_edge;
+    uint32_t edge_count;
+};
+
+struct RoomGraphCluster
+{
+    uint32_t first_node;
+    uint32_t node_count;
+    bool dirty; // NOTE: Pathing changed inside, the edge costs need refreshing
+};
+
+struct RoomGraph
+{
+    uint32_t node_count;
+    RoomGraphNode *nodes;
+
+    uint32_t edge_count;
+    RoomGraphEdge *edges;
+
+    // NOTE: Cluster 0 is the null cluster, for tiles that aren't in any. The nodes on the
+    // boundary of each cluster are a range of cluster_nodes.
+    uint32_t cluster_count;
+    RoomGraphCluster *clusters;
+    uint32_t *cluster_nodes;
+    uint32_t dirty_cluster_count;
+
+    uint16_t *tile_clusters;
+    uint16_t *tile_nodes; // NOTE: Node index + 1, 0 for tiles that aren't nodes
+};
+
+// NOTE: The result of a room graph query. leg is the tile path up to the first waypoint,
+// waypoints are the rest of the plan, ending at the target. Follow the leg, then ask again.
+struct RoomGraphPath
+{
+    bool found;
+    Path leg;
+
+    uint32_t waypoint_count;
+    V2i *waypoints;
+};
+
+//
+// NOTE: Path requests are searches that run in the background, on the low priority job queue,
+// so a burst of long searches doesn't land on whichever frame happened to ask for them. Submit
+// one with RequestPath, hang on to the ticket, and poll it with PollPathRequest until it's done.
+// Once a frame UpdatePathRequests picks up what the last job finished and kicks off the next
+// one, which gets PATH_REQUEST_NODE_BUDGET nodes to spend. A search that runs out of budget is
+// continued by the job after, so a long one is spread out over as many frames as it needs.
+//
+// The job searches against a snapshot of block_pathing, which only gets refreshed in between
+// jobs and never halfway through a search, so results can be a few frames behind the world.
+// They come with the pathing_version of the snapshot they were found on, to check against
+// chunk_pathing_versions. Only the first PATH_REQUEST_MAX_LENGTH steps of a path come back.
+//
+// Goals further out than PATH_REQUEST_ROOM_GRAPH_DISTANCE get planned on the room graph when
+// they're requested, and the job only searches up to a waypoint along the way. The path that
+// comes back stops there, short of the goal, and the next request picks up from it.
+//
+
+#define MAX_PATH_REQUESTS 256
+#define PATH_REQUEST_MAX_LENGTH 128
+#define PATH_REQUEST_NODE_BUDGET 2048
+#define PATH_REQUEST_ROOM_GRAPH_DISTANCE 32
+
+// NOTE: Like entity handles, a ticket goes stale once its request is released. Generations
+// start at 1, so the zero ticket never refers to anything.
+struct PathTicket
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+static inline bool
+operator == (PathTicket a, PathTicket b)
+{
+    return (a.index == b.index) && (a.generation == b.generation);
+}
+
+static inline bool
+operator != (PathTicket a, PathTicket b)
+{
+    return !(a == b);
+}
+
+enum PathRequestStatus
+{
+    PathRequest_Invalid, // NOTE: Stale or null ticket, or a free slot
+    PathRequest_Pending,
+    PathRequest_Found,
+    PathRequest_NotFound,
+};
+
+struct PathRequest
+{
+    // NOTE: Only ever touched by the main thread
+    uint32_t generation;
+    PathRequestStatus status;
+    bool in_job;   // NOTE: Handed off to the running job, hands off until it's done
+    bool released; // NOTE: Released while in_job, freed once the job's done with it
+
+    V2i start;
+    V2i goal;
+    V2i search_goal; // NOTE: The goal, or a room graph waypoint on the way there
+    PathOptions options;
+
+    // NOTE: Written by the job while in_job
+    bool found;
+    uint32_t pathing_version;
+    uint32_t length;
+    V2i positions[PATH_REQUEST_MAX_LENGTH];
+};
+
+struct PathRequests
+{
+    // NOTE: Owned by whichever job is running, or the main thread when none is
+    Pathfinder pathfinder;
+    TileBitplane snapshot;
+    uint32_t snapshot_version;
+
+    volatile uint32_t job_running;
+
+    // NOTE: The job works through the batch in order, so the ones it finished are the first
+    // done_count. searching is the request it ran out of budget on, if any.
+    uint32_t batch_count;
+    PathTicket batch[MAX_PATH_REQUESTS];
+    uint32_t done_count;
+    PathTicket searching;
+
+    // NOTE: Pending requests in the order they came in
+    uint32_t queue_count;
+    uint32_t queue[MAX_PATH_REQUESTS];
+
+    PathRequest requests[MAX_PATH_REQUESTS];
+};
+
+// NOTE: path points into the request, so it's only good until the ticket gets released
+struct PathRequestResult
+{
+    PathRequestStatus status;
+    V2i start;
+    V2i goal;
+    uint32_t pathing_version;
+    Path path;
+};
+
+//
+// NOTE: The path cache holds on to the paths entities are following, so they don't need a new
+// search every step. Entries are per entity, PATH_CACHE_WAYS to a set picked by the handle
+// index, and only hold the first PATH_CACHE_MAX_LENGTH steps of a path. An entry stays good as long as the entity
+// is where the path says it should be, the goal hasn't wandered off by more than a tile, and
+// none of the chunks the path goes through had their pathing change since it was found.
+//
+// New paths come from path requests. While one is out the entity keeps following the path it
+// had, as long as it's still on it, and otherwise waits in place until the search comes back.
+// A path that stops short of its goal asks for the rest PATH_CACHE_REFILL_DISTANCE steps early.
+//
+// A full set gives up the entry that was used the longest ago, but never one with a request
+// out, or two entities sharing a set would keep throwing away each other's searches. When every
+// entry in the set is waiting on a request, the entity goes without for the turn.
+//
+
+#define PATH_CACHE_SIZE 1024
+#define PATH_CACHE_WAYS 4
+#define PATH_CACHE_MAX_LENGTH 64
+#define PATH_CACHE_MAX_CHUNKS 8
+#define PATH_CACHE_REFILL_DISTANCE 8
+
+struct PathCacheEntry
+{
+    EntityHandle owner;
+    V2i start;
+    V2i goal;
+    uint32_t pathing_version;
+    PathTicket ticket; // NOTE: The search for the next path, if there's one out
+    uint32_t last_used_round;
+
+    uint32_t cursor; // NOTE: The next step to take
+    uint32_t length;
+    V2i positions[PATH_CACHE_MAX_LENGTH];
+
+    uint32_t chunk_count;
+    uint32_t chunks[PATH_CACHE_MAX_CHUNKS];
+};
+
+struct PathCache
+{
+    PathCacheEntry entries[PATH_CACHE_SIZE];
+
+    // NOTE: Tallies for the headless checks. Requests only get dropped when their owner is gone.
+    uint32_t requested_count;
+    uint32_t collected_count;
+    uint32_t dropped_count;
+    uint32_t full_count;
+};
+
+static inline bool GetCachedPathStep(Entity *e, V2i goal, V2i *step);
+static inline void UpdatePathRequests(void);
+static inline void MarkRoomGraphTileChanged(V2i p);
+
+#endif /* DUNGEONS_PATHFINDING_HPP */
@@ -7,7 +7,11 @@
 #define DUNGEONS_EXPORT
 #endif
 
+#if COMPILER_GCC
+#define SimpleAssert(x) ((x) ? 1 : (__builtin_trap(), 0))
+#else
 #define SimpleAssert(x) ((x) ? 1 : (__debugbreak(), 0))
+#endif
 #define Assert(x) \
     ((x) ? 1 \
          : (platform->ReportError(PlatformError_Fatal, \
@@ -118,6 +122,14 @@ AtomicExchange(volatile uint32_t *dest, uint32_t value)
     return result;
 }
 
+static inline uint32_t
+AtomicLoad(volatile uint32_t *source)
+{
+    // NOTE: Volatile reads already have acquire semantics with /volatile:ms, the default on x64
+    uint32_t result = *source;
+    return result;
+}
+
 static inline uint32_t
 GetThreadID()
 {
@@ -125,6 +137,50 @@ GetThreadID()
     uint32_t thread_id = *(uint32_t *)(thread_local_storage + 0x48);
     return thread_id;
 }
+#elif COMPILER_GCC
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static inline uint32_t
+AtomicAdd(volatile uint32_t *dest, uint32_t value)
+{
+    // NOTE: This returns the value _before_ adding
+    uint32_t result = __atomic_fetch_add(dest, value, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+static inline uint32_t
+AtomicIncrement(volatile uint32_t *dest)
+{
+    // NOTE: This returns the value _before_ adding
+    uint32_t result = __atomic_fetch_add(dest, 1, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+static inline uint32_t
+AtomicExchange(volatile uint32_t *dest, uint32_t value)
+{
+    // NOTE: This returns the value _before_ exchanging
+    uint32_t result = __atomic_exchange_n(dest, value, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+static inline uint32_t
+AtomicLoad(volatile uint32_t *source)
+{
+    uint32_t result = __atomic_load_n(source, __ATOMIC_ACQUIRE);
+    return result;
+}
+
+static inline uint32_t
+GetThreadID()
+{
+    uint32_t thread_id = (uint32_t)syscall(SYS_gettid);
+    return thread_id;
+}
 #elif COMPILER_LLVM
 // TODO: Force inline
 // TODO: Atomics
@@ -528,6 +584,10 @@ static Platform *platform;
 typedef APP_UPDATE_AND_RENDER(AppUpdateAndRenderType);
 extern "C" DUNGEONS_EXPORT APP_UPDATE_AND_RENDER(AppUpdateAndRender);
 
+#define APP_RUN_HEADLESS(name) int name(Platform *platform, int argument_count, char **arguments)
+typedef APP_RUN_HEADLESS(AppRunHeadlessType);
+extern "C" DUNGEONS_EXPORT APP_RUN_HEADLESS(AppRunHeadless);
+
 #if DUNGEONS_INTERNAL
 #include "dungeons_debug_interface.hpp"
 #endif
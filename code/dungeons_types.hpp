@@ -49,7 +49,7 @@ struct Buffer
 };
 typedef Buffer String;
 
-constexpr String
+static inline String
 operator ""_str(const char *data, size_t size)
 {
     String result = {};
@@ -104,6 +104,8 @@ PLATFORM_JOB(DoWorldGen)
     if (tiles->w % 2 == 0) tiles->w += 1;
     if (tiles->h % 2 == 0) tiles->h += 1;
 
+    InitializeEntityManager(tiles->w, tiles->h);
+
     Arena *arena = &tiles->arena;
     tiles->data = PushArray(arena, tiles->w*tiles->h, GenTile);
     tiles->seen_by_player = PushArray(arena, tiles->w*tiles->h, bool);
@@ -152,6 +154,7 @@ PLATFORM_JOB(DoWorldGen)
         {
             GenRoom *room = &tiles->rooms[tiles->room_count++];
             room->rect = room_rect;
+            AddSimRegion(room_rect);
 
             for (int y = room_rect.min.y; y < room_rect.max.y; ++y)
             for (int x = room_rect.min.x; x < room_rect.max.x; ++x)
@@ -443,19 +446,17 @@ PLATFORM_JOB(DoWorldGen)
         Entity *e = nullptr;
         if (tile == GenTile_Wall)
         {
-            e = AddWall(p);
+            SetTerrain(p, Terrain_Wall);
         }
         else if (tile == GenTile_RoomWall)
         {
-            e = AddWall(p);
-            e->sprites[0] = MakeSprite(Glyph_Solid, MakeColor(196, 196, 196));
+            SetTerrain(p, Terrain_RoomWall);
         }
         else if (tile == GenTile_Door)
         {
             e = AddDoor(p);
         }
-
-        if (!e)
+        else
         {
             static const V2i directions[] =
             {
@@ -488,7 +489,7 @@ PLATFORM_JOB(DoWorldGen)
             GenRoom *room = tiles->associated_rooms[IndexP(tiles, p)];
             if (room)
             {
-                PushToList(arena, &room->associated_entities, e->handle);
+                AddToList(&room->associated_entities, HandleFromEntity(e));
             }
         }
     }
@@ -506,9 +507,7 @@ PLATFORM_JOB(DoWorldGen)
     LockWithKey(chest, chest_key);
     AddToInventory(chest, AddGold({}, 420));
 
-    Entity *small_gem = AddEntity("Small Gem"_str, MakeV2i(0, 0), MakeSprite(Glyph_Diamond, MakeColor(0, 127, 255)));
-    SetContactTrigger(small_gem, Trigger_PickUp);
-    AddToInventory(chest, small_gem);
+    AddToInventory(chest, SpawnEntity(Prefab_SmallGem, MakeV2i(0, 0)));
 
     entity_manager->light_source = AddEntity("Torch"_str, player_spawn_p - MakeV2i(7, 5), MakeSprite('6', MakeColor(255, 192, 128)));
 
@@ -518,12 +517,10 @@ PLATFORM_JOB(DoWorldGen)
     Entity *key = AddEntity(StringLiteral("Shiny Key"), {}, MakeSprite(Glyph_Male, MakeColor(255, 200, 0)));
     AddToInventory(chest, key);
 
-    for (EntityNode *node = starting_room->associated_entities.first;
-         node;
-         node = node->next)
+    for (EntityListIter iter = IterateList(&starting_room->associated_entities); IsValid(iter); Next(&iter))
     {
-        Entity *e = EntityFromHandle(node->handle);
-        if (e && HasProperty(e, EntityProperty_Door))
+        Entity *e = iter.entity;
+        if (HasProperty(e, EntityProperty_Door))
         {
             LockWithKey(e, key);
         }
@@ -535,21 +532,23 @@ PLATFORM_JOB(DoWorldGen)
     Rect2i room_rect = MakeRect2iMinDim(0, 0, 25, 25);
     for (int x = room_rect.min.x; x <= room_rect.max.x; x += 1)
     {
-        AddWall(MakeV2i(x, room_rect.min.y));
-        AddWall(MakeV2i(x, room_rect.max.y));
+        SetTerrain(MakeV2i(x, room_rect.min.y), Terrain_Wall);
+        SetTerrain(MakeV2i(x, room_rect.max.y), Terrain_Wall);
     }
 
     for (int y = room_rect.min.y; y <= room_rect.max.y; y += 1)
     {
-        AddWall(MakeV2i(room_rect.min.x, y));
-        AddWall(MakeV2i(room_rect.max.x, y));
+        SetTerrain(MakeV2i(room_rect.min.x, y), Terrain_Wall);
+        SetTerrain(MakeV2i(room_rect.max.x, y), Terrain_Wall);
     }
 
-    AddWall(MakeV2i(11, 18));
-    AddWall(MakeV2i(12, 18));
-    AddWall(MakeV2i(13, 18));
+    SetTerrain(MakeV2i(11, 18), Terrain_Wall);
+    SetTerrain(MakeV2i(12, 18), Terrain_Wall);
+    SetTerrain(MakeV2i(13, 18), Terrain_Wall);
 #endif
 
+    BuildRoomGraph(tiles);
+
     tiles->complete = true;
 }
 
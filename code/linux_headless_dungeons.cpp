@@ -0,0 +1,385 @@
+#include "linux_headless_dungeons.hpp"
+
+//
+// NOTE: A bare bones Linux platform layer for running the simulation headless (see
+// dungeons_headless.cpp). No window, no input and no rendering, so it builds the game in
+// directly instead of loading it as a shared library. Build it with build.sh.
+//
+
+#include "dungeons.cpp"
+
+static LinuxState linux_state;
+static Platform platform_;
+
+#if DUNGEONS_INTERNAL
+static DebugTable debug_table_;
+#endif
+
+static __thread ThreadLocalContext *linux_thread_local_context;
+
+static void *
+Linux_Reserve(size_t size, uint32_t flags, const char *tag)
+{
+    UNUSED_VARIABLE(flags);
+    UNUSED_VARIABLE(tag);
+
+    // NOTE: Like on win32 the first page holds a header, so Deallocate knows how much to unmap
+    size_t page_size = platform->page_size;
+    size_t total_size = page_size + size;
+
+    void *memory = mmap(nullptr, total_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    mprotect(memory, page_size, PROT_READ|PROT_WRITE);
+
+    LinuxAllocationHeader *header = (LinuxAllocationHeader *)memory;
+    header->size = total_size;
+
+    return (char *)memory + page_size;
+}
+
+static void *
+Linux_Commit(void *pointer, size_t size)
+{
+    void *result = nullptr;
+    if (mprotect(pointer, size, PROT_READ|PROT_WRITE) == 0)
+    {
+        result = pointer;
+    }
+    return result;
+}
+
+static void *
+Linux_Allocate(size_t size, uint32_t flags, const char *tag)
+{
+    void *result = Linux_Reserve(size, flags, tag);
+    if (result)
+    {
+        result = Linux_Commit(result, size);
+    }
+    return result;
+}
+
+static void
+Linux_Decommit(void *pointer, size_t size)
+{
+    if (pointer)
+    {
+        madvise(pointer, size, MADV_DONTNEED);
+        mprotect(pointer, size, PROT_NONE);
+    }
+}
+
+static void
+Linux_Deallocate(void *pointer)
+{
+    if (pointer)
+    {
+        LinuxAllocationHeader *header = (LinuxAllocationHeader *)((char *)pointer - platform->page_size);
+        munmap(header, header->size);
+    }
+}
+
+static void
+Linux_DebugPrint(char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static void
+Linux_LogPrint(PlatformLogLevel level, char *fmt, ...)
+{
+    Arena *arena = platform->GetTempArena();
+    ScopedMemory temp(arena);
+
+    va_list args;
+    va_start(args, fmt);
+    String formatted = PushStringFV(arena, fmt, args);
+    va_end(args);
+
+    const char *prefix = "";
+    if      (level == PlatformLogLevel_Warning) prefix = "warning: ";
+    else if (level == PlatformLogLevel_Error)   prefix = "error: ";
+
+    fprintf(stdout, "%s%.*s\n", prefix, (int)formatted.size, (char *)formatted.data);
+    fflush(stdout);
+}
+
+static void
+Linux_ReportError(PlatformErrorType type, char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", (type == PlatformError_Fatal ? "fatal error" : "error"));
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    if (type == PlatformError_Fatal)
+    {
+        abort();
+    }
+}
+
+static bool
+Linux_NextEvent(PlatformEvent **out_event, PlatformEventFilter filter)
+{
+    UNUSED_VARIABLE(out_event);
+    UNUSED_VARIABLE(filter);
+    return false;
+}
+
+static Buffer
+Linux_ReadFile(Arena *arena, String filename)
+{
+    Buffer result = {};
+
+    Arena *temp_arena = platform->GetTempArena();
+    ScopedMemory temp(temp_arena);
+
+    String filename_terminated = PushStringF(temp_arena, "%.*s", (int)filename.size, (char *)filename.data);
+
+    FILE *file = fopen((char *)filename_terminated.data, "rb");
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        if (size > 0)
+        {
+            result.data = PushArrayNoClear(arena, (size_t)size, uint8_t);
+            result.size = fread(result.data, 1, (size_t)size, file);
+        }
+
+        fclose(file);
+    }
+
+    return result;
+}
+
+static PlatformHighResTime
+Linux_GetTime(void)
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    PlatformHighResTime result;
+    result.opaque = (uint64_t)time.tv_sec*1000000000ull + (uint64_t)time.tv_nsec;
+    return result;
+}
+
+static double
+Linux_SecondsElapsed(PlatformHighResTime start, PlatformHighResTime end)
+{
+    double result = (double)(end.opaque - start.opaque)*1e-9;
+    return result;
+}
+
+static void
+Linux_SleepThread(int milliseconds)
+{
+    usleep((useconds_t)milliseconds*1000);
+}
+
+static void
+Linux_DebugPauseThread(void)
+{
+}
+
+static inline void
+Linux_InitializeTLSForThread(ThreadLocalContext *context)
+{
+    linux_thread_local_context = context;
+
+    context->temp_arena      = &context->temp_arena_1_;
+    context->prev_temp_arena = &context->temp_arena_2_;
+}
+
+static ThreadLocalContext *
+Linux_GetThreadLocalContext(void)
+{
+    ThreadLocalContext *result = linux_thread_local_context;
+    Assert(result);
+    return result;
+}
+
+static Arena *
+Linux_GetTempArena(void)
+{
+    ThreadLocalContext *context = Linux_GetThreadLocalContext();
+    Arena *result = context->temp_arena;
+    return result;
+}
+
+// NOTE: Returns false if there was nothing to do
+static inline bool
+Linux_DoNextJob(PlatformJobQueue *queue)
+{
+    uint32_t entry_index = queue->next_read;
+    if (entry_index == queue->next_write)
+    {
+        return false;
+    }
+
+    if (__sync_bool_compare_and_swap(&queue->next_read, entry_index, entry_index + 1))
+    {
+        PlatformJobEntry *job = &queue->jobs[entry_index % ArrayCount(queue->jobs)];
+        job->proc(job->args);
+
+        __sync_sub_and_fetch(&queue->jobs_in_flight, 1);
+    }
+
+    return true;
+}
+
+struct LinuxThreadArgs
+{
+    ThreadLocalContext *context;
+    PlatformJobQueue *queue;
+};
+
+static void *
+Linux_ThreadProc(void *userdata)
+{
+    LinuxThreadArgs *args = (LinuxThreadArgs *)userdata;
+
+    Linux_InitializeTLSForThread(args->context);
+    PlatformJobQueue *queue = args->queue;
+
+    while (!queue->stop)
+    {
+        // TODO: Same as on win32, double buffered temp arenas don't buy the job threads much
+        ThreadLocalContext *context = args->context;
+        Swap(context->temp_arena, context->prev_temp_arena);
+        Clear(context->temp_arena);
+
+        if (!Linux_DoNextJob(queue))
+        {
+            sem_wait(&queue->run);
+        }
+    }
+
+    return nullptr;
+}
+
+static void
+Linux_InitializeJobQueue(PlatformJobQueue *queue, int thread_count)
+{
+    sem_init(&queue->run, 0, 0);
+
+    queue->tls = PushArray(&linux_state.arena, thread_count, ThreadLocalContext);
+
+    queue->thread_count = thread_count;
+    queue->threads = PushArray(&linux_state.arena, thread_count, pthread_t);
+
+    LinuxThreadArgs *args = PushArray(&linux_state.arena, thread_count, LinuxThreadArgs);
+    for (int i = 0; i < thread_count; ++i)
+    {
+        args[i].context = &queue->tls[i];
+        args[i].queue = queue;
+        pthread_create(&queue->threads[i], nullptr, Linux_ThreadProc, &args[i]);
+    }
+}
+
+static void
+Linux_AddJob(PlatformJobQueue *queue, void *args, PlatformJobProc *proc)
+{
+    uint32_t new_next_write = queue->next_write + 1;
+
+    PlatformJobEntry *entry = &queue->jobs[queue->next_write % ArrayCount(queue->jobs)];
+    entry->proc = proc;
+    entry->args = args;
+
+    __sync_add_and_fetch(&queue->jobs_in_flight, 1);
+    __sync_synchronize();
+
+    queue->next_write = new_next_write;
+
+    sem_post(&queue->run);
+}
+
+// NOTE: The calling thread pitches in until the queue is empty, then waits for the rest. Jobs
+// it runs share its temp arena, so they're on the hook for cleaning up after themselves.
+static void
+Linux_WaitForJobs(PlatformJobQueue *queue)
+{
+    while (queue->jobs_in_flight)
+    {
+        if (!Linux_DoNextJob(queue))
+        {
+            sched_yield();
+        }
+    }
+    __sync_synchronize();
+}
+
+static void
+Linux_CloseJobQueue(PlatformJobQueue *queue)
+{
+    queue->stop = true;
+    for (int i = 0; i < queue->thread_count; ++i)
+    {
+        sem_post(&queue->run);
+    }
+    for (int i = 0; i < queue->thread_count; ++i)
+    {
+        pthread_join(queue->threads[i], nullptr);
+    }
+    sem_destroy(&queue->run);
+}
+
+int
+main(int argument_count, char **arguments)
+{
+    platform = &platform_;
+
+    PlatformJobQueue high_priority_queue = {};
+    PlatformJobQueue  low_priority_queue = {};
+
+#if DUNGEONS_INTERNAL
+    platform->debug_table = &debug_table_;
+#endif
+
+    platform->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    platform->dt = 1.0f / 60.0f;
+    platform->NextEvent = Linux_NextEvent;
+    platform->high_priority_queue = &high_priority_queue;
+    platform->low_priority_queue = &low_priority_queue;
+    platform->DebugPrint = Linux_DebugPrint;
+    platform->LogPrint = Linux_LogPrint;
+    platform->ReportError = Linux_ReportError;
+    platform->AllocateMemory = Linux_Allocate;
+    platform->ReserveMemory = Linux_Reserve;
+    platform->CommitMemory = Linux_Commit;
+    platform->DecommitMemory = Linux_Decommit;
+    platform->DeallocateMemory = Linux_Deallocate;
+    platform->GetThreadLocalContext = Linux_GetThreadLocalContext;
+    platform->GetTempArena = Linux_GetTempArena;
+    platform->AddJob = Linux_AddJob;
+    platform->WaitForJobs = Linux_WaitForJobs;
+    platform->DebugPauseThread = Linux_DebugPauseThread;
+    platform->ReadFile = Linux_ReadFile;
+    platform->GetTime = Linux_GetTime;
+    platform->SecondsElapsed = Linux_SecondsElapsed;
+    platform->SleepThread = Linux_SleepThread;
+
+    ThreadLocalContext tls_context = {};
+    Linux_InitializeTLSForThread(&tls_context);
+
+    int core_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    Linux_InitializeJobQueue(&high_priority_queue, Max(core_count - 1, 1));
+    Linux_InitializeJobQueue(&low_priority_queue, 2);
+
+    int result = AppRunHeadless(platform, argument_count, arguments);
+
+    Linux_CloseJobQueue(&high_priority_queue);
+    Linux_CloseJobQueue(&low_priority_queue);
+
+    return result;
+}
@@ -0,0 +1,58 @@
+#ifndef LINUX_HEADLESS_DUNGEONS_HPP
+#define LINUX_HEADLESS_DUNGEONS_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+
+#include "dungeons_platform.hpp"
+#include "dungeons_shared.hpp"
+#include "dungeons_memory.hpp"
+
+struct LinuxAllocationHeader
+{
+    size_t size;
+};
+
+struct PlatformJobEntry
+{
+    PlatformJobProc *proc;
+    void *args;
+};
+
+struct PlatformJobQueue
+{
+    sem_t run;
+    volatile bool stop;
+
+    int thread_count;
+    pthread_t *threads;
+    ThreadLocalContext *tls;
+
+    volatile uint32_t jobs_in_flight;
+    volatile uint32_t next_write;
+    volatile uint32_t next_read;
+    PlatformJobEntry jobs[256];
+
+    StaticAssert(IsPow2(ArrayCount(jobs)), "Jobs array must be a power of 2");
+};
+
+struct ThreadLocalContext
+{
+    Arena *temp_arena;
+    Arena *prev_temp_arena;
+
+    Arena temp_arena_1_;
+    Arena temp_arena_2_;
+};
+
+struct LinuxState
+{
+    Arena arena;
+};
+
+#endif /* LINUX_HEADLESS_DUNGEONS_HPP */